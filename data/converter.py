@@ -3,12 +3,14 @@ from camera import Camera
 from pathlib import Path
 import sys
 import json
+from scene_binary import write_scene_binary
 
 if len(sys.argv) != 4:
-    print("Usage: %s input_folder input_dataset output_json" % sys.argv[0])
+    print("Usage: %s input_folder input_dataset output_file" % sys.argv[0])
+    print("  output_file: .json, or .vkgs for the binary scene format")
     exit(1)
 
-input_folder, input_dataset, output_json = sys.argv[1:]
+input_folder, input_dataset, output_file = sys.argv[1:]
 
 train_cameras, test_cameras, scene_info = load_dataset(
     Path(input_folder),
@@ -22,13 +24,20 @@ def cam2json(camera:Camera):
         "projection": camera.projection_matrix.tolist()
     }
 
+train_json = [ cam2json(c) for c in train_cameras ]
+test_json  = [ cam2json(c) for c in test_cameras ]
+
+if Path(output_file).suffix == ".vkgs":
+    write_scene_binary(output_file, train_json, test_json, scene_info.point_cloud.points, scene_info.point_cloud.colors)
+    exit(0)
+
 data = {
-    "train_cameras": [ cam2json(c) for c in train_cameras ],
-    "test_cameras":  [ cam2json(c) for c in test_cameras ],
+    "train_cameras": train_json,
+    "test_cameras":  test_json,
     "points":  scene_info.point_cloud.points.tolist(),
     "colors":  scene_info.point_cloud.colors.tolist(),
     "normals": scene_info.point_cloud.normals.tolist()
 }
 
-with open(output_json, 'w') as f:
+with open(output_file, 'w') as f:
     json.dump(data, f)
\ No newline at end of file
@@ -0,0 +1,14 @@
+from scene_binary import write_scene_binary
+import sys
+import json
+
+if len(sys.argv) != 3:
+    print("Usage: %s input_json output_vkgs" % sys.argv[0])
+    exit(1)
+
+input_json, output_vkgs = sys.argv[1:]
+
+with open(input_json, 'r') as f:
+    data = json.load(f)
+
+write_scene_binary(output_vkgs, data["train_cameras"], data["test_cameras"], data["points"], data["colors"])
@@ -0,0 +1,57 @@
+import struct
+import numpy as np
+
+# Writer for the binary .vkgs scene container read by PointCloudScene::LoadBinary (src/Scene/PointCloudFile.hpp).
+
+MAGIC = b"VKGS"
+VERSION = 1
+HEADER_FORMAT = "<4sIIIQQQQQ"
+CAMERA_FORMAT = "<16f16fII8x"
+ALIGNMENT = 16
+
+def _align(offset):
+    return (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1)
+
+def _pack_matrix(m):
+    # matrices are given row-major (as in the JSON format), stored column-major
+    return np.asarray(m, dtype=np.float32).reshape(4, 4).T.flatten().tolist()
+
+def write_scene_binary(path, train_cameras, test_cameras, points, colors):
+    """
+    train_cameras/test_cameras: lists of dicts with "image_name", "view" and "projection" (row-major 4x4)
+    points: (N,3) positions, colors: (N,3) or (N,4) colors
+    """
+    cameras = list(train_cameras) + list(test_cameras)
+
+    points = np.ascontiguousarray(np.asarray(points, dtype=np.float32).reshape(-1, 3))
+    colors = np.asarray(colors, dtype=np.float32).reshape(len(points), -1)
+    if colors.shape[1] == 3:
+        colors = np.concatenate([colors, np.ones((len(colors), 1), dtype=np.float32)], axis=1)
+    colors = np.ascontiguousarray(colors)
+
+    names = bytearray()
+    camera_blocks = bytearray()
+    for c in cameras:
+        name = c["image_name"].encode("utf-8")
+        camera_blocks += struct.pack(CAMERA_FORMAT, *_pack_matrix(c["view"]), *_pack_matrix(c["projection"]), len(names), len(name))
+        names += name
+
+    cameras_offset = _align(struct.calcsize(HEADER_FORMAT))
+    strings_offset = _align(cameras_offset + len(camera_blocks))
+    points_offset  = _align(strings_offset + len(names))
+    colors_offset  = _align(points_offset + points.nbytes)
+
+    with open(path, "wb") as f:
+        def pad_to(offset):
+            f.write(b"\0" * (offset - f.tell()))
+
+        f.write(struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(train_cameras), len(test_cameras), len(points),
+                            cameras_offset, strings_offset, points_offset, colors_offset))
+        pad_to(cameras_offset)
+        f.write(camera_blocks)
+        pad_to(strings_offset)
+        f.write(names)
+        pad_to(points_offset)
+        f.write(points.tobytes())
+        pad_to(colors_offset)
+        f.write(colors.tobytes())
@@ -1,37 +1,153 @@
 #pragma once
 
+#include <span>
+#include <unordered_map>
+
 #include <Rose/Core/CommandContext.hpp>
 #include "BufferGradient.hpp"
+#include "ShaderPrecompiler.hpp"
 
 namespace vkgsplat {
 
 using namespace RoseEngine;
 
+// One parameter tensor of a fused update
+struct AdamTensor {
+	ShaderParameter parameters;
+	uint32_t channels;
+	uint32_t count;
+	float    stepScale; // multiplies AdamOptimizer::stepSize
+
+	template<int N>
+	inline static AdamTensor Create(const BufferGradient<N>& p, const float stepScale = 1) {
+		return AdamTensor{ p.GetShaderParameter(), (uint32_t)N, (uint32_t)p.size(), stepScale };
+	}
+};
+
 struct AdamOptimizer {
+	static constexpr uint32_t kMaxFusedTensors = 4;
+
 	std::vector<ref<Pipeline>> pipelines;
+	std::unordered_map<std::string, ref<Pipeline>> fusedPipelines; // keyed by the tensors' channel counts
 
 	float stepSize = 0.001f; // α
 	float decay1 = 0.9f;     // β1
 	float decay2 = 0.999f;   // β2
 	uint32_t t = 0;
+	uint32_t discardedSteps = 0; // steps the renderer discarded, counted once their loss is read back
+	BufferRange<float> stepLoss; // loss of the step being updated. If NaN, the update leaves everything unchanged.
 
-	inline void reset() { t = 0; }
+	inline void reset() { t = 0; discardedSteps = 0; }
 	inline void increment() { t++; }
 
+	inline Pipeline& GetPipeline(Device& device, const uint32_t channels) {
+		if (pipelines.size() <= channels) pipelines.resize(channels+1);
+		ref<Pipeline>& pipeline = pipelines[channels];
+		if (!pipeline) pipeline = Pipeline::CreateCompute(device, ShaderModule::Create(device, FindShaderPath("Adam.cs.slang"), "main", "sm_6_7", { { "NUM_CHANNELS", std::to_string(channels) } }));
+		return *pipeline;
+	}
+
+	// entryPoint is "fused" or "sparse"
+	inline Pipeline& GetFusedPipeline(Device& device, const std::span<const uint32_t> channels, const std::string& entryPoint = "fused") {
+		std::string key = entryPoint;
+		ShaderDefines defines = { { "NUM_TENSORS", std::to_string(channels.size()) } };
+		for (uint32_t i = 0; i < channels.size(); i++) {
+			key += std::to_string(channels[i]);
+			defines["TENSOR" + std::to_string(i) + "_CHANNELS"] = std::to_string(channels[i]);
+		}
+		ref<Pipeline>& pipeline = fusedPipelines[key];
+		if (!pipeline) pipeline = Pipeline::CreateCompute(device, ShaderModule::Create(device, FindShaderPath("Adam.cs.slang"), entryPoint, "sm_6_7", defines));
+		return *pipeline;
+	}
+
+	// Registers the unfused pipeline of every tensor, and the fused and sparse pipelines of all of them
+	inline void Precompile(ShaderPrecompiler& precompiler, const std::vector<uint32_t>& tensorChannels) {
+		for (const uint32_t c : tensorChannels)
+			precompiler.Add([this, c](Device& device) { GetPipeline(device, c); });
+		for (const char* entryPoint : { "fused", "sparse" })
+			precompiler.Add([this, tensorChannels, entryPoint](Device& device) {
+				for (size_t i = 0; i < tensorChannels.size(); i += kMaxFusedTensors)
+					GetFusedPipeline(device, std::span(tensorChannels).subspan(i, std::min<size_t>(kMaxFusedTensors, tensorChannels.size() - i)), entryPoint);
+			});
+	}
+
+	inline void SetStepParameters(CommandContext& context, ShaderParameter& params) const {
+		params["stepSize"]   = stepSize;
+		params["decayRates"] = float2(decay1, decay2);
+		params["t"]  = t;
+		params["discardedSteps"] = std::min(discardedSteps, t);
+		if (stepLoss)
+			params["stepLoss"] = (BufferParameter)stepLoss;
+		else {
+			const BufferRange<float> zero = context.GetTransientBuffer<float>(1, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst);
+			context.Fill(zero, 0.f);
+			params["stepLoss"] = (BufferParameter)zero;
+		}
+	}
+
+	// Shader parameters of a batch of at most kMaxFusedTensors tensors, and their channel counts
+	inline ShaderParameter GetFusedShaderParameters(CommandContext& context, const std::span<const AdamTensor> batch, std::vector<uint32_t>& channels, uint32_t& total) const {
+		ShaderParameter params = {};
+		uint4  ends = uint4(0);
+		float4 stepSizes = float4(0);
+		total = 0;
+		channels.resize(batch.size());
+		for (uint32_t i = 0; i < batch.size(); i++) {
+			params["tensor" + std::to_string(i)] = batch[i].parameters;
+			channels[i] = batch[i].channels;
+			total += batch[i].count;
+			ends[i] = total;
+			stepSizes[i] = stepSize * batch[i].stepScale;
+		}
+		params["tensorEnds"]      = ends;
+		params["tensorStepSizes"] = stepSizes;
+		params["parameterCount"]  = total;
+		SetStepParameters(context, params);
+		return params;
+	}
+
 	template<int N>
-	inline void operator()(CommandContext& context, const BufferGradient<N>& parameters) {
-		if (pipelines.size() <= N) pipelines.resize(N+1);
-		
-		ref<Pipeline>& pipeline = pipelines[N];
-		if (!pipeline) pipeline = Pipeline::CreateCompute(context.GetDevice(), ShaderModule::Create(context.GetDevice(), FindShaderPath("Adam.cs.slang"), "main", "sm_6_7", { { "NUM_CHANNELS", std::to_string(N) } }));
-		
+	inline void operator()(CommandContext& context, const BufferGradient<N>& parameters, const float stepScale = 1) {
+		Pipeline& pipeline = GetPipeline(context.GetDevice(), N);
+
 		ShaderParameter params = {};
 		params["parameters"] = parameters.GetShaderParameter();
 		params["parameterCount"] = (uint32_t)parameters.size();
-		params["stepSize"] = stepSize;
-		params["decayRates"] = float2(decay1, decay2);
-		params["t"]  = t;
-		context.Dispatch(*pipeline, (uint32_t)parameters.size(), params);
+		SetStepParameters(context, params);
+		params["stepSize"] = stepSize * stepScale;
+		context.Dispatch(pipeline, (uint32_t)parameters.size(), params);
+	}
+
+	// Updates every tensor in a single dispatch and zeroes the consumed gradients, so the caller does
+	// not need to clear them before the next backward pass. Gradients must be zero before the first call.
+	inline void operator()(CommandContext& context, const std::span<const AdamTensor> tensors) {
+		for (size_t offset = 0; offset < tensors.size(); offset += kMaxFusedTensors) {
+			const auto batch = tensors.subspan(offset, std::min<size_t>(kMaxFusedTensors, tensors.size() - offset));
+
+			std::vector<uint32_t> channels;
+			uint32_t total;
+			const ShaderParameter params = GetFusedShaderParameters(context, batch, channels, total);
+			context.Dispatch(GetFusedPipeline(context.GetDevice(), channels), total, params);
+		}
+	}
+
+	// Sparse fused update of per-point tensors: only updates the points in a touched list (see TouchedPoints in
+	// PointCloud.hpp), and decays their moments for the steps in which they had no gradient and were skipped.
+	// Skipped steps do not move the parameters, unlike a dense update with the decaying moments.
+	// Zeroes the consumed gradients like the fused update. threadCount threads stride over the list.
+	inline void operator()(CommandContext& context, const std::span<const AdamTensor> tensors, const BufferRange<uint32_t>& touchedList, const uint32_t touchedStamp, uint32_t threadCount) {
+		threadCount = std::max((threadCount + 63) / 64 * 64, 64u);
+		for (size_t offset = 0; offset < tensors.size(); offset += kMaxFusedTensors) {
+			const auto batch = tensors.subspan(offset, std::min<size_t>(kMaxFusedTensors, tensors.size() - offset));
+
+			std::vector<uint32_t> channels;
+			uint32_t total;
+			ShaderParameter params = GetFusedShaderParameters(context, batch, channels, total);
+			params["touched"]      = (BufferParameter)touchedList;
+			params["touchedStamp"] = touchedStamp;
+			params["threadCount"]  = threadCount;
+			context.Dispatch(GetFusedPipeline(context.GetDevice(), channels, "sparse"), threadCount, params);
+		}
 	}
 };
 
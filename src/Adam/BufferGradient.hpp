@@ -1,33 +1,235 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <optional>
+#include <string_view>
+#include <glm/gtc/packing.hpp>
 #include <Rose/Core/CommandContext.hpp>
 
+#include "QueueSync.hpp"
+
 namespace vkgsplat {
 
 using namespace RoseEngine;
 
+// Storage format of a BufferGradient buffer. Must match the kFormat constants in BufferGradient.slang.
+enum class BufferFormat : uint32_t {
+    eFloat32,
+    eFloat16,
+    eBFloat16,
+    eUnorm8, // one 32-bit word per element, values clamped to [0,1]
+};
+
+inline const char* to_string(const BufferFormat f) {
+    switch (f) {
+    case BufferFormat::eFloat32:  return "fp32";
+    case BufferFormat::eFloat16:  return "fp16";
+    case BufferFormat::eBFloat16: return "bf16";
+    case BufferFormat::eUnorm8:   return "unorm8";
+    }
+    return "";
+}
+
+// Element stride in bytes. 16-bit elements are padded to whole 32-bit words (see formatStrideWords).
+inline uint32_t FormatStride(const BufferFormat f, const uint32_t n) {
+    switch (f) {
+    case BufferFormat::eFloat16:
+    case BufferFormat::eBFloat16: return ((n + 1) / 2) * 4;
+    case BufferFormat::eUnorm8:   return 4;
+    default:                      return n * 4;
+    }
+}
+
+// Storage formats of one optimized attribute
+struct BufferGradientFormat {
+    BufferFormat data      = BufferFormat::eFloat32; // read by the renderers
+    BufferFormat gradients = BufferFormat::eFloat32; // always fp32, see Resolved
+    BufferFormat moments1  = BufferFormat::eFloat32;
+    BufferFormat moments2  = BufferFormat::eFloat32;
+    bool master = false; // keep an fp32 copy of data for Adam to update. Forced for unorm8 data.
+
+    // 16-bit moments. bf16 for the 2nd moment, since squared gradients underflow fp16.
+    inline static BufferGradientFormat CompactMoments() {
+        return { .moments1 = BufferFormat::eFloat16, .moments2 = BufferFormat::eBFloat16 };
+    }
+    // fp16 data and moments. Colors only: positions need an fp32 master for Adam and fp32 data for sorting,
+    // so compact positions would take as much memory as fp32 ones.
+    inline static BufferGradientFormat Compact() {
+        return { .data = BufferFormat::eFloat16, .gradients = BufferFormat::eFloat32, .moments1 = BufferFormat::eFloat16, .moments2 = BufferFormat::eBFloat16 };
+    }
+
+    inline bool HasMaster() const { return master || data == BufferFormat::eUnorm8; }
+
+    // unorm8 clamps to [0,1], and 16-bit positions need an fp32 master, which costs the memory they save.
+    // Positions can still use compact moments.
+    inline bool ValidForPositions() const { return data == BufferFormat::eFloat32; }
+
+    // Forces a master for unorm8 data, fp32 for unorm8 moments, which are signed, and fp32 gradients: 16-bit
+    // gradients would accumulate by compare-and-swap, rounding after every add, so once a sum reaches 2^k,
+    // contributions below 2^(k-11) are lost.
+    inline BufferGradientFormat Resolved() const {
+        BufferGradientFormat f = *this;
+        f.master = HasMaster();
+        f.gradients = BufferFormat::eFloat32;
+        for (BufferFormat* s : { &f.moments1, &f.moments2 })
+            if (*s == BufferFormat::eUnorm8) *s = BufferFormat::eFloat32;
+        return f;
+    }
+
+    // "fp32", "compact-moments", "compact" (colors only) or "unorm8" (unorm8 data with an fp32 master, compact
+    // moments; colors only)
+    inline static std::optional<BufferGradientFormat> FromPreset(const std::string_view name) {
+        if (name == "fp32")            return BufferGradientFormat{};
+        if (name == "compact-moments") return CompactMoments();
+        if (name == "compact")         return Compact();
+        if (name == "unorm8") {
+            BufferGradientFormat f = CompactMoments();
+            f.data = BufferFormat::eUnorm8;
+            f.master = true;
+            return f;
+        }
+        return std::nullopt;
+    }
+};
+
 template<int N>
 struct BufferGradient {
     using T = glm::vec<N,float>;
 
-    BufferRange<T> data;
-    BufferRange<T> gradients;
-    BufferRange<T> moments1;
-    BufferRange<T> moments2;
+    BufferRange<std::byte> data;
+    BufferRange<std::byte> master;
+    BufferRange<std::byte> gradients;
+    BufferRange<std::byte> moments1;
+    BufferRange<std::byte> moments2;
+    BufferGradientFormat format = {};
+    uint32_t count = 0;
 
     inline operator bool() const { return data; }
-    inline vk::DeviceSize size() const { return data.size(); }
+    inline vk::DeviceSize size() const { return count; }
+    inline vk::DeviceSize size_bytes() const {
+        return data.size_bytes() + (master ? master.size_bytes() : 0) + gradients.size_bytes() + moments1.size_bytes() + moments2.size_bytes();
+    }
+
+    // fp32 values, for kernels that read raw float vectors
+    inline const BufferRange<std::byte>& FullPrecisionData() const { return master ? master : data; }
+
+    inline static BufferGradient Create(CommandContext& context, const std::span<const T> values, BufferGradientFormat format = {}) {
+        format = format.Resolved();
+        BufferGradient r = { .format = format, .count = (uint32_t)values.size() };
+
+        auto createBuffer = [&](const BufferFormat f, const vk::BufferUsageFlags usage) -> BufferRange<std::byte> {
+            return SharedQueueFamilies::CreateBuffer(context.GetDevice(), std::max<size_t>(size_t(FormatStride(f, N)) * values.size(), 4), vk::BufferUsageFlagBits::eStorageBuffer|usage);
+        };
+        auto upload = [&]<typename U>(const std::span<const U> v) -> BufferRange<std::byte> {
+            const BufferRange<std::byte> b = SharedQueueFamilies::CreateBuffer(context.GetDevice(), std::max<size_t>(v.size_bytes(), 4), vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
+            if (!v.empty())
+                context.Copy(context.UploadData(v, vk::BufferUsageFlagBits::eTransferSrc).template cast<std::byte>(), b.slice(0, v.size_bytes()));
+            return b;
+        };
 
-    inline void clearGradients(CommandContext& context) const { context.Fill(gradients.cast<float>(), 0.f); }
+        if (format.data == BufferFormat::eFloat32)
+            r.data = upload(values);
+        else
+            r.data = upload(std::span<const uint32_t>(PackValues(format.data, values)));
+        if (format.master)
+            r.master = upload(values);
+        r.gradients = createBuffer(format.gradients, vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
+        r.moments1  = createBuffer(format.moments1,  vk::BufferUsageFlagBits::eTransferDst);
+        r.moments2  = createBuffer(format.moments2,  vk::BufferUsageFlagBits::eTransferDst);
+        r.clearGradients(context);
+        return r;
+    }
+
+    // Uninitialized data and moments with zeroed gradients, e.g. to compact a point cloud into
+    inline static BufferGradient Allocate(CommandContext& context, const uint32_t count, BufferGradientFormat format = {}) {
+        format = format.Resolved();
+        BufferGradient r = { .format = format, .count = count };
+
+        const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst;
+        auto createBuffer = [&](const BufferFormat f) -> BufferRange<std::byte> {
+            return SharedQueueFamilies::CreateBuffer(context.GetDevice(), std::max<size_t>(size_t(FormatStride(f, N)) * count, 4), usage);
+        };
+        r.data = createBuffer(format.data);
+        if (format.master)
+            r.master = createBuffer(BufferFormat::eFloat32);
+        r.gradients = createBuffer(format.gradients);
+        r.moments1  = createBuffer(format.moments1);
+        r.moments2  = createBuffer(format.moments2);
+        r.clearGradients(context);
+        return r;
+    }
+
+    // Packs values into 32-bit words, in the layout BufferGradient.slang reads
+    inline static std::vector<uint32_t> PackValues(const BufferFormat f, const std::span<const T> values) {
+        const uint32_t strideWords = FormatStride(f, N) / 4;
+        std::vector<uint32_t> words(std::max<size_t>(values.size() * strideWords, 1), 0u);
+        for (size_t i = 0; i < values.size(); i++) {
+            for (uint32_t c = 0; c < N; c++) {
+                const float v = values[i][c];
+                switch (f) {
+                case BufferFormat::eFloat16:
+                    words[i*strideWords + c/2] |= uint32_t(glm::packHalf1x16(v)) << ((c%2)*16);
+                    break;
+                case BufferFormat::eBFloat16: {
+                    const uint32_t u = std::bit_cast<uint32_t>(v);
+                    words[i*strideWords + c/2] |= ((u + 0x7FFF + ((u >> 16) & 1)) >> 16) << ((c%2)*16);
+                    break;
+                }
+                case BufferFormat::eUnorm8:
+                    words[i*strideWords] |= uint32_t(std::round(std::clamp(v, 0.f, 1.f) * 255)) << (c*8);
+                    break;
+                default:
+                    words[i*strideWords + c] = std::bit_cast<uint32_t>(v);
+                    break;
+                }
+            }
+        }
+        return words;
+    }
+
+    inline void clearGradients(CommandContext& context) const { context.Fill(gradients.cast<uint32_t>(), 0u); }
 
     inline ShaderParameter GetShaderParameter() const {
         ShaderParameter params = {};
-        params["data"]      = (BufferParameter)data;
-        params["gradients"] = (BufferParameter)gradients;
-        params["moments1"]  = (BufferParameter)moments1;
-        params["moments2"]  = (BufferParameter)moments2;
+        params["data"]           = (BufferParameter)data;
+        params["master"]         = (BufferParameter)(master ? master : data);
+        params["gradients"]      = (BufferParameter)gradients;
+        params["moments1"]       = (BufferParameter)moments1;
+        params["moments2"]       = (BufferParameter)moments2;
+        params["dataFormat"]     = (uint32_t)format.data;
+        params["gradientFormat"] = (uint32_t)format.gradients;
+        params["moment1Format"]  = (uint32_t)format.moments1;
+        params["moment2Format"]  = (uint32_t)format.moments2;
+        params["hasMaster"]      = (uint32_t)(master ? 1 : 0);
         return params;
     }
+
+    // Copy of the optimized values, to restart optimization from
+    struct Snapshot {
+        BufferRange<std::byte> data;
+        BufferRange<std::byte> master;
+    };
+
+    inline Snapshot CreateSnapshot(CommandContext& context) const {
+        auto copy = [&](const BufferRange<std::byte>& src) -> BufferRange<std::byte> {
+            if (!src) return {};
+            BufferRange<std::byte> dst = Buffer::Create(context.GetDevice(), src.size_bytes(), vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eTransferSrc);
+            context.Copy(src, dst);
+            return dst;
+        };
+        return Snapshot{ copy(data), copy(master) };
+    }
+
+    // Restores the values and zeroes the gradients and moments, so optimization restarts from the snapshot
+    inline void Restore(CommandContext& context, const Snapshot& s) const {
+        if (s.data && s.data.size_bytes() == data.size_bytes()) context.Copy(s.data, data);
+        if (s.master && master && s.master.size_bytes() == master.size_bytes()) context.Copy(s.master, master);
+        clearGradients(context);
+        context.Fill(moments1.cast<uint32_t>(), 0u);
+        context.Fill(moments2.cast<uint32_t>(), 0u);
+    }
 };
 
 }
\ No newline at end of file
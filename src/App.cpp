@@ -1,25 +1,70 @@
 #include <Rose/Core/WindowedApp.hpp>
-#include "Adam/Adam.hpp"
+#include <Rose/Core/Instance.hpp>
 #include <portable-file-dialogs.h>
 
-#include "PointCloudRenderer/PointCloudRenderer.hpp"
+#include "Trainer/AsyncTrainer.hpp"
+#include "PointCloudRenderer/PointCloudLod.hpp"
 
 using namespace vkgsplat;
 using namespace RoseEngine;
 
+bool SupportsMeshShaders(const vk::raii::PhysicalDevice& physicalDevice) {
+	return std::ranges::any_of(physicalDevice.enumerateDeviceExtensionProperties(), [](const vk::ExtensionProperties& e) {
+		return std::string_view(e.extensionName.data()) == VK_EXT_MESH_SHADER_EXTENSION_NAME;
+	});
+}
+
+// WindowedApp selects its device itself and has no optional extensions, so only request mesh shaders when
+// whichever device it selects supports them
+bool AllDevicesSupportMeshShaders() {
+	const ref<Instance> instance = Instance::Create({}, {});
+	vk::raii::PhysicalDevices physicalDevices(**instance);
+	return !physicalDevices.empty() && std::ranges::all_of(physicalDevices, [](const vk::raii::PhysicalDevice& pd) { return SupportsMeshShaders(pd); });
+}
+
 int main(int argc, const char** argv) {
-	WindowedApp app("GaussianRenderer", {
+	std::vector<std::string> deviceExtensions = {
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-		VK_EXT_MESH_SHADER_EXTENSION_NAME,
 		VK_EXT_SHADER_ATOMIC_FLOAT_EXTENSION_NAME,
-	});
+	};
+	const bool requestMeshShaders = AllDevicesSupportMeshShaders();
+	if (requestMeshShaders) deviceExtensions.emplace_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+	WindowedApp app("GaussianRenderer", deviceExtensions);
+
+	// without mesh shaders, the viewport uses the compute rasterizer
+	const bool meshShaders = requestMeshShaders && SupportsMeshShaders(app.device->PhysicalDevice());
 
 	PipelineCache computeAlphaPipeline = PipelineCache(FindShaderPath("InvertAlpha.cs.slang"));
 
 	PointCloudScene    scene;
 	ViewportCamera     camera;
 	PointCloudRenderer renderer;
-	AdamOptimizer      adam;
+	Trainer            trainer;
+	PointCloudLod      lod;
+	AsyncTrainer       asyncTrainer(app.device, app.contexts[0]->QueueFamily());
+	GpuProfiler        profiler(*app.device, app.contexts[0]->QueueFamily());
+	for (const auto& c : app.contexts) profiler.SetActive(*c);
+	scene.buildLod = true;
+	renderer.meshShaders = meshShaders;
+
+	const char* scenePath = nullptr;
+	bool precompile = true;
+	for (int i = 1; i < argc; i++) {
+		if (std::string_view(argv[i]) == "--no-precompile") precompile = false;
+		else scenePath = argv[i];
+	}
+
+	// compile every shader variant while the window opens and the scene loads.
+	// the viewport and input views do not render until it has completed.
+	ShaderPrecompiler precompiler;
+	if (precompile) {
+		precompiler.Add(computeAlphaPipeline);
+		renderer.Precompile(precompiler, vk::Format::eR16G16B16A16Sfloat);
+		trainer.Precompile(precompiler);
+		asyncTrainer.Precompile(precompiler, vk::Format::eR16G16B16A16Sfloat, meshShaders);
+		lod.Precompile(precompiler);
+		precompiler.Start(app.device);
+	}
 
 	float3 sceneTranslation = float3(0);
 	float3 sceneRotation = float3(0);
@@ -29,81 +74,18 @@ int main(int argc, const char** argv) {
 	int  selectedView = -1;
 	bool showReference = true;
 
-	float resolutionScale = 0.25f;
-	float currentLoss = std::numeric_limits<float>::infinity();
 	bool runOptimizer = false;
-	// cache initial data so we can quickly restart optimization
-	BufferRange<float3> initialVertices;
-	BufferRange<float4> initialVertexColors;
+	bool asyncTraining = true; // train on asyncTrainer's queue instead of the viewport's context
 	ImageView viewportRenderTarget;
 	ImageView inputViewRenderTarget;
-	ImageView optimizerRenderTarget;
-	ImageView optimizerRefImg;
-	std::queue<std::pair<BufferRange<float>, uint64_t>> lossCpuQueue;
-
-	auto stepOptimizer = [&](CommandContext& context) {
-		if (adam.t == 0)
-			currentLoss = -1;
-
-		BufferRange<float> lossBuf;
-		BufferRange<float> lossCpu;
-		if (!lossCpuQueue.empty()) {
-			auto [lossCpu_, value] = lossCpuQueue.front();
-			if (context.GetDevice().CurrentTimelineValue() >= value) {
-				lossCpu = lossCpu_;
-				currentLoss = (currentLoss < 0) ? lossCpu[0] : lerp(lossCpu[0], currentLoss, 0.9);
-				lossCpuQueue.pop();
-			}
-		}
-		if (!lossCpu) lossCpu = Buffer::Create(context.GetDevice(), sizeof(float), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent, VMA_ALLOCATION_CREATE_MAPPED_BIT|VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
-		lossCpuQueue.push({ lossCpu, context.GetDevice().NextTimelineSignal() });
-		lossBuf = context.GetTransientBuffer<float>(1, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
-
-		const uint32_t imageIndex = rand() % scene.numTrainCameras;
-		const Transform view = Transform{ scene.viewTransformsCpu[imageIndex] };
-		const Transform proj = Transform{ scene.projectionTransformsCpu[imageIndex] };
-
-		ImageView refImg = scene.images[imageIndex];
-		const uint2 scaledExtent = max(uint2(float2(refImg.Extent())*resolutionScale), uint2(1));
-		const bool isExtentScaled = scaledExtent.x != refImg.Extent().x || scaledExtent.y != refImg.Extent().y;
-
-		if (!optimizerRenderTarget || optimizerRenderTarget.Extent().x != scaledExtent.x || optimizerRenderTarget.Extent().y != scaledExtent.y) {
-			optimizerRenderTarget = ImageView::Create(
-				Image::Create(context.GetDevice(), ImageInfo{
-					.format = vk::Format::eR16G16B16A16Sfloat,
-					.extent = uint3(scaledExtent, 1u),
-					.usage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eStorage,
-					.queueFamilies = { context.QueueFamily() } }));
-		}
-		if (isExtentScaled) {
-			if (!optimizerRefImg || optimizerRefImg.Extent().x != scaledExtent.x || optimizerRefImg.Extent().y != scaledExtent.y) {
-				optimizerRefImg = ImageView::Create(
-					Image::Create(context.GetDevice(), ImageInfo{
-						.format = refImg.GetImage()->Info().format,
-						.extent = uint3(scaledExtent, 1u),
-						.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
-						.queueFamilies = { context.QueueFamily() } }));
-			}
-		} else {
-			optimizerRefImg = {};
-		}
-		
-		if (isExtentScaled) {
-			context.Blit(refImg, optimizerRefImg);
-			refImg = optimizerRefImg;
-		}
-
-		context.Fill(lossBuf, 0.f);
-		scene.pointCloud.vertices.clearGradients(context);
-		scene.pointCloud.vertexColors.clearGradients(context);
-
-		renderer.RenderGradients(context, optimizerRenderTarget, scene.pointCloud, view, proj, refImg, lossBuf);
-
-		context.Copy(lossBuf, lossCpu);
 
-		adam(context, scene.pointCloud.vertices);
-		adam(context, scene.pointCloud.vertexColors);
-		adam.increment();
+	// While training asynchronously, the scene's points are written on asyncTrainer's queue, so draw its last snapshot,
+	// or nothing until the first one completed. Otherwise, drains the async training before the points are used.
+	auto getDrawnPoints = [&](CommandContext& context) -> const PointCloud* {
+		if (runOptimizer && asyncTraining)
+			return asyncTrainer.GetSnapshot(context);
+		asyncTrainer.Wait();
+		return &scene.pointCloud;
 	};
 
 	auto openSceneDialog = [&]() {
@@ -111,28 +93,26 @@ int main(int argc, const char** argv) {
 		auto f = pfd::open_file(
 			"Choose scene",
 			"",
-			{ "JSON files (.json)", "*.json" },
+			{ "Scene files (.vkgs .json)", "*.vkgs *.json", "COLMAP reconstructions (sparse/0/*.bin)", "*.bin" },
 			false
 		);
 		for (const std::string& filepath : f.result()) {
+			asyncTrainer.Wait();
 			app.device->Wait();
 
-			scene.Load(context, filepath);
-
-			// backup initial data
-			initialVertices     = Buffer::Create(context.GetDevice(), scene.pointCloud.vertices.data.size_bytes(),     vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eTransferSrc);
-			initialVertexColors = Buffer::Create(context.GetDevice(), scene.pointCloud.vertexColors.data.size_bytes(), vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eTransferSrc);
-			context.Copy(scene.pointCloud.vertices.data,     initialVertices);
-			context.Copy(scene.pointCloud.vertexColors.data, initialVertexColors);
-
-			adam.reset();
+			scene.Load(context, filepath, true);
+			renderer.temporalSort.Reset();
+			lod.Reset();
+			asyncTrainer.Reset();
+			trainer.SaveInitialState(context, scene);
 		}
 	};
 
 	// load input scene
-	if (argc > 1) {
+	if (scenePath) {
 		app.contexts[0]->Begin();
-		scene.Load(*app.contexts[0], argv[1]);
+		scene.Load(*app.contexts[0], scenePath, true);
+		trainer.SaveInitialState(*app.contexts[0], scene);
 		app.contexts[0]->Submit();
 	}
 
@@ -143,13 +123,27 @@ int main(int argc, const char** argv) {
 	});
 
 	app.AddWidget("Properties", [&]() {
+		profiler.Update();
+
 		if (ImGui::CollapsingHeader("Camera")) {
 			camera.DrawInspectorGui();
 		}
 
 		if (ImGui::CollapsingHeader("Scene")) {
 			ImGui::Text("%u views (%u train)", scene.images.size(), scene.numTrainCameras);
+			if (scene.imageLoader) {
+				ImGui::Text("Loading views: %u/%u", scene.imageLoader->NumCompleted(), scene.imageLoader->NumImages());
+				ImGui::ProgressBar(scene.LoadProgress());
+			}
 			ImGui::Text("%u vertices", scene.pointCloud.size());
+			if (scene.pointCloud.vertices) {
+				const auto&[number,unit] = FormatNumber(scene.pointCloud.size_bytes());
+				ImGui::Text("%.2f%sB point storage", number, unit);
+			}
+			if (scene.streamer && ImGui::TreeNode("Streaming")) {
+				scene.streamer->DrawGui();
+				ImGui::TreePop();
+			}
 			ImGui::DragFloat3("Translation", &sceneTranslation.x, 0.1f);
 			ImGui::DragFloat3("Rotation", &sceneRotation.x, float(M_1_PI)*0.1f, -float(M_PI), float(M_PI));
 			ImGui::DragFloat("Scale", &sceneScale, 0.01f, 0.f, 1000.f);
@@ -161,32 +155,78 @@ int main(int argc, const char** argv) {
 			if (viewportRenderTarget) {
 				ImGui::Text("%u x %u", viewportRenderTarget.Extent().x, viewportRenderTarget.Extent().y);
 			}
+			precompiler.DrawGui();
 			renderer.DrawGui(app.CurrentContext());
+			if (ImGui::TreeNode("Level of detail")) {
+				lod.DrawGui(scene.lod, scene.pointCloud);
+				ImGui::TreePop();
+			}
+		}
+
+		if (ImGui::CollapsingHeader("GPU timings")) {
+			profiler.DrawGui();
 		}
 
 		if (ImGui::CollapsingHeader("Optimizer")) {
 			ImGui::Checkbox("Run", &runOptimizer);
 			ImGui::SameLine();
 			if (ImGui::Button("Reset")) {
-				adam.reset();
-				if (scene.pointCloud.vertices) {
-					// restore initial data
-					app.CurrentContext().Copy(initialVertices,     scene.pointCloud.vertices.data);
-					app.CurrentContext().Copy(initialVertexColors, scene.pointCloud.vertexColors.data);
-				}
+				asyncTrainer.Wait();
+				trainer.RestoreInitialState(app.CurrentContext(), scene);
+				lod.dirty = true;
 			}
 			
-			ImGui::DragFloat("Step size", &adam.stepSize, 0.001f, 0, 1.f);
-			ImGui::DragFloat2("Decay rates", &adam.decay1, 0.001f, 0, 1.0f - 1e-6f);
-
-			if (ImGui::SliderFloat("Resolution scale", &resolutionScale, 0.f, 1.f)) app.device->Wait();
-
-			const uint2 extent = scene.images.empty() ? uint2(0) : uint2(scene.images[0].Extent());
-			const uint2 scaledExtent = max(uint2(float2(extent)*resolutionScale), uint2(1));
+			ImGui::DragFloat("Step size", &trainer.adam.stepSize, 0.001f, 0, 1.f);
+			ImGui::DragFloat2("Decay rates", &trainer.adam.decay1, 0.001f, 0, 1.0f - 1e-6f);
+			ImGui::DragFloat("Position step scale", &trainer.vertexStepScale, 0.01f, 0, 100.f);
+			ImGui::DragFloat("Color step scale", &trainer.colorStepScale, 0.01f, 0, 100.f);
+			ImGui::Checkbox("Fused update", &trainer.fusedAdam);
+			if (trainer.fusedAdam) ImGui::Checkbox("Sparse update", &trainer.sparseAdam);
+
+			if (ImGui::SliderFloat("Resolution scale", &trainer.resolutionScale, 0.f, 1.f)) app.device->Wait();
+			if (ImGui::Checkbox("Async compute", &asyncTraining)) app.device->Wait();
+			if (asyncTraining) asyncTrainer.DrawGui();
+			static const uint32_t minBatchSize = 1, maxBatchSize = 16;
+			ImGui::SliderScalar("Batch size", ImGuiDataType_U32, &trainer.batchSize, &minBatchSize, &maxBatchSize);
+			trainer.sampler.DrawGui();
+
+			const uint2 extent = (scene.images.empty() || !scene.images[0]) ? uint2(0) : uint2(scene.images[0].Extent());
+			const uint2 scaledExtent = max(uint2(float2(extent)*trainer.resolutionScale), uint2(1));
 			const auto&[number,unit] = FormatNumber(scaledExtent.x * scaledExtent.y);
 			ImGui::Text("%u x %u (%.2f%s pixels)", scaledExtent.x, scaledExtent.y, number, unit);
+			if (const size_t cacheBytes = trainer.ScaledReferenceBytes(); cacheBytes > 0) {
+				const auto&[cacheNumber,cacheUnit] = FormatNumber(cacheBytes);
+				ImGui::Text("%.2f%sB scaled reference cache", cacheNumber, cacheUnit);
+			}
+
+			ImGui::Text("Iteration: %u, loss: %f", trainer.adam.t, trainer.currentLoss);
 
-			ImGui::Text("Iteration: %u, loss: %f", adam.t, currentLoss);
+			if (ImGui::TreeNode("Densification")) {
+				trainer.densify.DrawGui();
+				ImGui::TreePop();
+			}
+
+			if (ImGui::TreeNode("Storage (applies on load)")) {
+				auto storagePresets = [](const char* label, BufferGradientFormat& f, const bool positions) {
+					static const char* presets[] = { "fp32", "compact-moments", "compact", "unorm8" };
+					ImGui::PushID(label);
+					for (const char* preset : presets) {
+						const auto pf = BufferGradientFormat::FromPreset(preset);
+						if (positions && !pf->ValidForPositions()) continue;
+						if (ImGui::RadioButton(preset, pf->data == f.data && pf->gradients == f.gradients && pf->moments1 == f.moments1 && pf->moments2 == f.moments2))
+							f = *pf;
+						ImGui::SameLine();
+					}
+					ImGui::TextUnformatted(label);
+					ImGui::PopID();
+				};
+				storagePresets("Positions", scene.vertexFormat, true);
+				storagePresets("Colors",    scene.colorFormat,  false);
+				uint32_t budgetMiB = uint32_t(scene.streamingBudget >> 20);
+				if (ImGui::DragScalar("Streaming budget (MiB)", ImGuiDataType_U32, &budgetMiB))
+					scene.streamingBudget = size_t(budgetMiB) << 20;
+				ImGui::TreePop();
+			}
 		}
 	}, true);
 
@@ -199,7 +239,23 @@ int main(int argc, const char** argv) {
 
 		auto& context = app.CurrentContext();
 
-		if (runOptimizer && !scene.images.empty()) stepOptimizer(context);
+		const bool trainingAsync = runOptimizer && asyncTraining;
+		if (!trainingAsync) asyncTrainer.Wait();
+
+		scene.UpdateLoading(context);
+
+		if (!precompiler.Done()) {
+			precompiler.DrawGui();
+			return;
+		}
+
+		if (runOptimizer) {
+			if (asyncTraining)
+				asyncTrainer.Update(context, scene, trainer, renderer);
+			else
+				trainer.Step(context, scene, renderer);
+			lod.dirty = true;
+		}
 
 		const float2 extentf = std::bit_cast<float2>(ImGui::GetWindowContentRegionMax()) - std::bit_cast<float2>(ImGui::GetWindowContentRegionMin());
 		const uint2 extent = uint2(extentf);
@@ -219,11 +275,31 @@ int main(int argc, const char** argv) {
 
 		// render the scene into viewportRenderTarget
 		
-		context.PushDebugLabel("App::Render");
+		GpuProfiler::PushRegion(context, "App::Render");
 
         const Transform view = inverse(camera.GetCameraToWorld()) * getSceneToWorld();
 		const Transform proj = camera.GetProjection(extentf.x / extentf.y);
-		renderer.Render(context, viewportRenderTarget, scene.pointCloud, view, proj);
+		// while training asynchronously, let training page the points
+		const PointCloud* points = getDrawnPoints(context);
+		if (!points) {
+			GpuProfiler::PopRegion(context);
+			return;
+		}
+		if (scene.streamer && !trainingAsync) {
+			const float4x4 viewProjection = proj.transform * view.transform;
+			scene.streamer->Update(context, std::span(&viewProjection, 1));
+		}
+		if (lod.IsUsable(scene.lod, *points)) {
+			// the selected points change every frame, so the previous frame's order cannot be reused
+			lod.AdaptPixelError(profiler.Last("App::Render"));
+			const PointCloud selected = lod.Select(context, scene.lod, *points, view, proj, extent, renderer.pointSize);
+			renderer.Render(context, viewportRenderTarget, selected, view, proj);
+		} else {
+			SortedPoints sorted = {};
+			if (!renderer.UseComputeRaster() && renderer.temporalSort.enabled)
+				sorted = renderer.SortTemporal(context, *points, view, proj, extent);
+			renderer.Render(context, viewportRenderTarget, *points, view, proj, sorted);
+		}
 		
 		// compute alpha = 1 - T
 		{
@@ -234,7 +310,7 @@ int main(int argc, const char** argv) {
 			context.Dispatch(*computeAlphaPipeline.get(context.GetDevice()), extent, params);
 		}
 
-		context.PopDebugLabel();
+		GpuProfiler::PopRegion(context);
 	}, true, WindowedApp::WidgetFlagBits::eNoBorders);
 
 	app.AddWidget("Input Views", [&]() {
@@ -245,11 +321,16 @@ int main(int argc, const char** argv) {
 			if (selectedView >= scene.images.size()) selectedView = scene.images.size()-1;
 			if (selectedView >= 0) {
 				ImageView img = scene.images[selectedView];
+				if (!img) {
+					ImGui::Text("Loading...");
+					return;
+				}
 
 				ImGui::SameLine();
 				ImGui::Checkbox("Show reference", &showReference);
 
-				if (!showReference) {
+				const PointCloud* points = !showReference && precompiler.Done() ? getDrawnPoints(context) : nullptr;
+				if (points) {
 					if (!inputViewRenderTarget || inputViewRenderTarget.Extent().x != img.Extent().x || inputViewRenderTarget.Extent().y != img.Extent().y) {
 						inputViewRenderTarget = ImageView::Create(
 							Image::Create(context.GetDevice(), ImageInfo{
@@ -259,11 +340,11 @@ int main(int argc, const char** argv) {
 								.queueFamilies = { context.QueueFamily() } }));
 					}
 
-					context.PushDebugLabel("InputViewWidget::Render");
+					GpuProfiler::PushRegion(context, "InputViewWidget::Render");
 
 					const Transform view = Transform{ scene.viewTransformsCpu[selectedView] };
 					const Transform proj = Transform{ scene.projectionTransformsCpu[selectedView] };
-					renderer.Render(context, inputViewRenderTarget, scene.pointCloud, view, proj);
+					renderer.Render(context, inputViewRenderTarget, *points, view, proj);
 
 					// compute alpha = 1 - T
 					{
@@ -273,7 +354,7 @@ int main(int argc, const char** argv) {
 						context.Dispatch(*computeAlphaPipeline.get(context.GetDevice()), inputViewRenderTarget.Extent(), params);
 					}
 
-					context.PopDebugLabel();
+					GpuProfiler::PopRegion(context);
 
 					img = inputViewRenderTarget;
 				}
@@ -0,0 +1,562 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+#include "HeadlessContext.hpp"
+#include "PointCloudRenderer/CpuPointCloudRenderer.hpp"
+#include "Trainer/Trainer.hpp"
+
+using namespace vkgsplat;
+using namespace RoseEngine;
+
+// Headless performance benchmark over synthetic scenes. For every point count and resolution, times the sort, the
+// rasterization, RenderGradients and an Adam step with GPU timestamps, and prints the median, mean and variance of
+// each as JSON. With --baseline, medians are compared to a previous output, and the exit code is 2 if any pass
+// regressed. Baselines from another device, or results with another rasterizer, are not compared.
+//
+// The sort and render passes are the ones the rasterizer runs: with mesh shaders, the depth sort and the draw of
+// the sorted points; with the compute rasterizer, tile binning including the tile key sort, and the tile rendering.
+// RenderGradients includes its own binning and sort, as in training. Every configuration starts from the
+// uploaded points, since Adam steps move them.
+//
+//   vkgsplat-benchmark [--points N,N,...] [--resolutions WxH,WxH,...] [--views N] [--samples N] [--warmup N]
+//                      [--point-scale S] [--rasterizer auto|mesh|compute] [--baseline FILE] [--tolerance T]
+//                      [--device NAME] [--seed N] [--output FILE] [--validate] [--validate-tolerance T]
+//
+// Points are uniform in [-1,1]^3 with random colors, seen by --views cameras on a circle around them. Points are
+// --point-scale times their mean spacing wide, so overdraw stays similar across point counts.
+// Runs on software implementations such as lavapipe (--device llvmpipe), which use the compute rasterizer.
+// A pass regressed if its median exceeds the baseline's by more than --tolerance, and by more than two baseline
+// standard deviations.
+//
+// With --validate, nothing is timed. Instead RenderGradients is compared to CpuPointCloudRenderer on the first point
+// count and resolution, and the CPU gradients are compared to central differences of the CPU loss. The exit code is 3
+// if an error exceeds --validate-tolerance (relative L2 error, 1% by default; 5% for the finite differences).
+
+struct BenchmarkArgs {
+	std::vector<uint32_t> pointCounts = { 10'000, 100'000, 1'000'000, 10'000'000 };
+	std::vector<uint2>    resolutions = { uint2(640, 360), uint2(1280, 720), uint2(1920, 1080) };
+	uint32_t views      = 4;
+	uint32_t samples    = 10;
+	uint32_t warmup     = 2;
+	float    pointScale = 2;
+	float    tolerance  = 0.1f;
+	uint32_t seed       = 0;
+	bool     validate   = false;
+	float    validateTolerance = 0.01f;
+	std::string rasterizer = "auto";
+	std::string device;
+	std::filesystem::path baseline;
+	std::filesystem::path output;
+
+	inline bool Parse(int argc, const char** argv) {
+		for (int i = 1; i < argc; i++) {
+			const std::string_view arg = argv[i];
+			auto next = [&]() -> const char* {
+				if (i + 1 >= argc) {
+					std::cerr << "Missing value for " << arg << std::endl;
+					return nullptr;
+				}
+				return argv[++i];
+			};
+			auto split = [](const char* v) {
+				std::vector<std::string> items;
+				std::stringstream ss(v);
+				for (std::string item; std::getline(ss, item, ',');)
+					if (!item.empty()) items.emplace_back(item);
+				return items;
+			};
+			const char* v = nullptr;
+			if (arg == "--points") {
+				if (!(v = next())) return false;
+				pointCounts.clear();
+				for (const std::string& s : split(v)) pointCounts.emplace_back(std::stoul(s));
+			} else if (arg == "--resolutions") {
+				if (!(v = next())) return false;
+				resolutions.clear();
+				for (const std::string& s : split(v)) {
+					const size_t x = s.find('x');
+					if (x == std::string::npos) {
+						std::cerr << "Invalid resolution " << s << std::endl;
+						return false;
+					}
+					resolutions.emplace_back(uint2(std::stoul(s.substr(0, x)), std::stoul(s.substr(x + 1))));
+				}
+			}
+			else if (arg == "--views")       { if (!(v = next())) return false; views = std::max<uint32_t>(std::stoul(v), 1); }
+			else if (arg == "--samples")     { if (!(v = next())) return false; samples = std::max<uint32_t>(std::stoul(v), 1); }
+			else if (arg == "--warmup")      { if (!(v = next())) return false; warmup = std::stoul(v); }
+			else if (arg == "--point-scale") { if (!(v = next())) return false; pointScale = std::stof(v); }
+			else if (arg == "--tolerance")   { if (!(v = next())) return false; tolerance = std::stof(v); }
+			else if (arg == "--seed")        { if (!(v = next())) return false; seed = std::stoul(v); }
+			else if (arg == "--rasterizer")  { if (!(v = next())) return false; rasterizer = v; }
+			else if (arg == "--baseline")    { if (!(v = next())) return false; baseline = v; }
+			else if (arg == "--device")      { if (!(v = next())) return false; device = v; }
+			else if (arg == "--output")      { if (!(v = next())) return false; output = v; }
+			else if (arg == "--validate")    { validate = true; }
+			else if (arg == "--validate-tolerance") { if (!(v = next())) return false; validateTolerance = std::stof(v); }
+			else {
+				std::cerr << "Unknown argument " << arg << std::endl;
+				return false;
+			}
+		}
+		return !pointCounts.empty() && !resolutions.empty();
+	}
+};
+
+inline nlohmann::json GetStatistics(std::vector<double> samples) {
+	std::ranges::sort(samples);
+	const size_t n = samples.size();
+	const double median = n % 2 ? samples[n/2] : (samples[n/2 - 1] + samples[n/2]) / 2;
+	double mean = 0;
+	for (const double s : samples) mean += s;
+	mean /= n;
+	double variance = 0;
+	for (const double s : samples) variance += (s - mean) * (s - mean);
+	variance /= std::max<size_t>(n - 1, 1);
+	return {
+		{ "median",   median },
+		{ "mean",     mean },
+		{ "variance", variance },
+		{ "min",      samples.front() },
+		{ "max",      samples.back() },
+	};
+}
+
+// Cameras on a circle of radius 3 around the origin, looking at it with a 60 degree horizontal fov
+inline void CreateCameras(const uint32_t count, const uint2 extent, std::vector<Transform>& views, std::vector<Transform>& projections) {
+	const float focal = extent.x / (2 * std::tan(float(M_PI) / 6));
+	for (uint32_t i = 0; i < count; i++) {
+		const float  angle  = 2 * float(M_PI) * (i + 0.5f) / count;
+		const float3 center = float3(3 * std::cos(angle), 0.5f, 3 * std::sin(angle));
+		// COLMAP camera axes: x right, y down, z forward
+		const float3 forward = normalize(-center);
+		const float3 right   = normalize(cross(forward, float3(0, 1, 0)));
+		const float3 down    = cross(forward, right);
+		const float3x3 rotation = float3x3(right, down, forward);
+		views.emplace_back(Transform{ ColmapScene::MakeViewTransform(rotation, -float3(dot(right, center), dot(down, center), dot(forward, center))) });
+		projections.emplace_back(Transform{ ColmapScene::MakeProjection(float2(focal), float2(extent)) });
+	}
+}
+
+// Compares the medians of every pass to the baseline result with the same point count, resolution and rasterizer.
+// Baselines from another device or timing method are rejected.
+inline nlohmann::json CompareToBaseline(const nlohmann::json& result, const nlohmann::json& baseline, const float tolerance, bool& regressed) {
+	nlohmann::json comparison = nlohmann::json::array();
+	for (const char* key : { "device", "timing" }) {
+		if (baseline.value(key, "") != result[key]) {
+			std::cerr << "Not comparing to the baseline: its " << key << " is " << baseline.value(key, "unknown") << ", not " << result[key] << std::endl;
+			return comparison;
+		}
+	}
+	for (const auto& r : result["results"]) {
+		const auto b = std::ranges::find_if(baseline["results"], [&](const nlohmann::json& b) {
+			return b["points"] == r["points"] && b["width"] == r["width"] && b["height"] == r["height"];
+		});
+		if (b == baseline["results"].end()) continue;
+		if ((*b)["rasterizer"] != r["rasterizer"]) {
+			std::cerr << "Not comparing " << r["points"] << " points, " << r["width"] << "x" << r["height"] << ": the baseline used the "
+			          << (*b)["rasterizer"] << " rasterizer, not " << r["rasterizer"] << std::endl;
+			continue;
+		}
+		for (const auto& [pass, stats] : r["passMilliseconds"].items()) {
+			if (!(*b)["passMilliseconds"].contains(pass)) continue;
+			const nlohmann::json& baseStats = (*b)["passMilliseconds"][pass];
+			const double baseMedian = baseStats["median"].get<double>();
+			const double median     = stats["median"].get<double>();
+			const double threshold  = std::max(tolerance * baseMedian, 2 * std::sqrt(baseStats["variance"].get<double>()));
+			const bool   regression = median > baseMedian + threshold;
+			regressed |= regression;
+			comparison.push_back({
+				{ "points",     r["points"] },
+				{ "width",      r["width"] },
+				{ "height",     r["height"] },
+				{ "pass",       pass },
+				{ "baseline",   baseMedian },
+				{ "median",     median },
+				{ "ratio",      baseMedian > 0 ? median / baseMedian : 0 },
+				{ "regression", regression },
+			});
+			if (regression)
+				std::cerr << "Regression: " << pass << " at " << r["points"] << " points, " << r["width"] << "x" << r["height"] << ": "
+				          << median << " ms, baseline " << baseMedian << " ms" << std::endl;
+		}
+	}
+	return comparison;
+}
+
+// Uniform points in [-1,1]^3 with random colors
+inline void CreatePoints(const uint32_t count, std::mt19937& rng, std::vector<float3>& vertices, std::vector<float4>& vertexColors) {
+	std::uniform_real_distribution<float> position(-1, 1), color(0, 1);
+	vertices.resize(count);
+	vertexColors.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		vertices[i]     = float3(position(rng), position(rng), position(rng));
+		vertexColors[i] = float4(color(rng), color(rng), color(rng), 0.25f + 0.5f * color(rng));
+	}
+}
+
+template<typename T>
+inline BufferRange<T> CreateReadbackBuffer(Device& device, const size_t count) {
+	return Buffer::Create(device, std::max<size_t>(count * sizeof(T), 4), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent, VMA_ALLOCATION_CREATE_MAPPED_BIT|VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+}
+
+// sqrt(sum (a-b)^2 / sum b^2)
+inline double RelativeError(const std::span<const float> a, const std::span<const float> b) {
+	double diff = 0, norm = 0;
+	for (size_t i = 0; i < a.size(); i++) {
+		diff += double(a[i] - b[i]) * double(a[i] - b[i]);
+		norm += double(b[i]) * double(b[i]);
+	}
+	return std::sqrt(diff / std::max(norm, 1e-30));
+}
+
+template<typename T>
+inline std::span<const float> AsFloats(const std::span<const T> v) {
+	return std::span<const float>(reinterpret_cast<const float*>(v.data()), v.size() * sizeof(T) / sizeof(float));
+}
+
+// Renders the first point count at the first resolution with RenderGradients and with CpuPointCloudRenderer, and
+// compares the images, losses and gradients. Then checks the CPU gradients of the points with the largest
+// gradients against central differences of the CPU loss.
+inline nlohmann::json Validate(HeadlessContext& h, PointCloudRenderer& renderer, const BenchmarkArgs& args, bool& failed) {
+	CommandContext& context = *h.context;
+	Device& device = context.GetDevice();
+	const uint32_t pointCount = args.pointCounts.front();
+	const uint2    extent     = args.resolutions.front();
+
+	std::mt19937 rng(args.seed);
+	std::vector<float3> vertices;
+	std::vector<float4> vertexColors;
+	CreatePoints(pointCount, rng, vertices, vertexColors);
+	renderer.pointSize = args.pointScale * 2 / std::cbrt(float(pointCount));
+
+	std::vector<Transform> views, projections;
+	CreateCameras(1, extent, views, projections);
+	const Transform& view = views[0];
+	const Transform& proj = projections[0];
+
+	// reference image, quantized the same way for both renderers
+	CpuPointCloudRenderer::Image referenceCpu{ extent, std::vector<float4>(size_t(extent.x) * extent.y) };
+	std::vector<uint32_t> referencePacked(referenceCpu.pixels.size());
+	for (uint32_t y = 0; y < extent.y; y++) {
+		for (uint32_t x = 0; x < extent.x; x++) {
+			const float4 c = float4(0.5f + 0.5f * std::sin(x * 0.05f), 0.5f + 0.5f * std::sin(y * 0.07f), 0.5f, 1);
+			const uint4  q = uint4(glm::round(glm::clamp(c, 0.f, 1.f) * 255.f));
+			referenceCpu[uint2(x, y)] = float4(q) / 255.f;
+			referencePacked[size_t(y) * extent.x + x] = q.x | (q.y << 8) | (q.z << 16) | (q.w << 24);
+		}
+	}
+
+	PointCloudScene scene;
+	context.Begin();
+	scene.UploadPoints(context, vertices, vertexColors);
+
+	const ImageView reference = ImageView::Create(
+		Image::Create(device, ImageInfo{
+			.format = vk::Format::eR8G8B8A8Unorm,
+			.extent = uint3(extent, 1u),
+			.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+			.queueFamilies = { context.QueueFamily() } }));
+	context.Copy(context.UploadData(std::span<const uint32_t>(referencePacked), vk::BufferUsageFlagBits::eTransferSrc).cast<std::byte>(), reference);
+
+	const ImageView target = ImageView::Create(
+		Image::Create(device, ImageInfo{
+			.format = vk::Format::eR32G32B32A32Sfloat,
+			.extent = uint3(extent, 1u),
+			.usage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eStorage,
+			.queueFamilies = { context.QueueFamily() } }));
+
+	const BufferRange<float> lossBuf = context.GetTransientBuffer<float>(1, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
+	context.Fill(lossBuf, 0.f);
+	renderer.RenderGradients(context, target, scene.pointCloud, view, proj, reference, lossBuf);
+
+	const BufferRange<float4> imageCpu         = CreateReadbackBuffer<float4>(device, referenceCpu.pixels.size());
+	const BufferRange<float3> vertexGradsCpu   = CreateReadbackBuffer<float3>(device, pointCount);
+	const BufferRange<float4> colorGradsCpu    = CreateReadbackBuffer<float4>(device, pointCount);
+	const BufferRange<float>  lossCpu          = CreateReadbackBuffer<float>(device, 1);
+	context.Copy(scene.pointCloud.vertices.gradients.cast<float3>(), vertexGradsCpu);
+	context.Copy(scene.pointCloud.vertexColors.gradients.cast<float4>(), colorGradsCpu);
+	context.Copy(lossBuf, lossCpu);
+	context.AddBarrier(target, Image::ResourceState{
+		.layout = vk::ImageLayout::eTransferSrcOptimal,
+		.stage  = vk::PipelineStageFlagBits2::eCopy,
+		.access = vk::AccessFlagBits2::eTransferRead,
+		.queueFamily = context.QueueFamily() });
+	context.AddBarrier(imageCpu, Buffer::ResourceState{
+		.stage  = vk::PipelineStageFlagBits2::eCopy,
+		.access = vk::AccessFlagBits2::eTransferWrite,
+		.queueFamily = context.QueueFamily() });
+	context.ExecuteBarriers();
+	context->copyImageToBuffer(**target.GetImage(), vk::ImageLayout::eTransferSrcOptimal, **imageCpu.mBuffer, vk::BufferImageCopy{
+		.bufferOffset      = imageCpu.mOffset,
+		.bufferRowLength   = 0,
+		.bufferImageHeight = 0,
+		.imageSubresource  = vk::ImageSubresourceLayers{ .aspectMask = vk::ImageAspectFlagBits::eColor, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1 },
+		.imageOffset       = vk::Offset3D{ 0, 0, 0 },
+		.imageExtent       = vk::Extent3D{ extent.x, extent.y, 1 } });
+	context.Submit();
+	device.Wait();
+
+	const std::span<const float4> imageGpu(&imageCpu[0], referenceCpu.pixels.size());
+	const std::span<const float3> vertexGradsGpu(&vertexGradsCpu[0], pointCount);
+	const std::span<const float4> colorGradsGpu(&colorGradsCpu[0], pointCount);
+	const double lossGpu = lossCpu[0];
+
+	CpuPointCloudRenderer cpu;
+	cpu.pointSize = renderer.pointSize;
+	const CpuPointCloudRenderer::PointCloud points{ vertices, vertexColors };
+	std::vector<float3> vertexGrads(pointCount, float3(0));
+	std::vector<float4> colorGrads(pointCount, float4(0));
+	CpuPointCloudRenderer::Image image;
+	const double loss = cpu.RenderGradients(points, { vertexGrads, colorGrads }, view.transform, proj.transform, referenceCpu, &image);
+
+	const double imageError       = RelativeError(AsFloats(imageGpu), AsFloats(std::span<const float4>(image.pixels)));
+	const double lossError        = std::abs(lossGpu - loss) / std::max(std::abs(loss), 1e-30);
+	const double vertexGradsError = RelativeError(AsFloats(vertexGradsGpu), AsFloats(std::span<const float3>(vertexGrads)));
+	const double colorGradsError  = RelativeError(AsFloats(colorGradsGpu), AsFloats(std::span<const float4>(colorGrads)));
+
+	// central differences for the points with the largest color gradients
+	const auto cpuLoss = [&](const std::span<const float3> v, const std::span<const float4> c) {
+		const CpuPointCloudRenderer::Image img = cpu.Render({ v, c }, view.transform, proj.transform, extent);
+		double l = 0;
+		for (size_t i = 0; i < img.pixels.size(); i++)
+			l += CpuPointCloudRenderer::ComputeLoss(img.pixels[i], referenceCpu.pixels[i]);
+		return l;
+	};
+	std::vector<uint32_t> checked(pointCount);
+	std::iota(checked.begin(), checked.end(), 0u);
+	const size_t checkedCount = std::min<size_t>(checked.size(), 16);
+	std::partial_sort(checked.begin(), checked.begin() + checkedCount, checked.end(), [&](const uint32_t a, const uint32_t b) {
+		return length(colorGrads[a]) > length(colorGrads[b]);
+	});
+	checked.resize(checkedCount);
+	const float step = 1e-3f;
+	std::vector<float> vertexFd, vertexAnalytic, colorFd, colorAnalytic;
+	std::vector<float3> v = vertices;
+	std::vector<float4> c = vertexColors;
+	for (const uint32_t i : checked) {
+		for (uint32_t k = 0; k < 3; k++) {
+			const float x = v[i][k];
+			v[i][k] = x + step; const double lp = cpuLoss(v, c);
+			v[i][k] = x - step; const double lm = cpuLoss(v, c);
+			v[i][k] = x;
+			vertexFd.emplace_back(float((lp - lm) / (2 * step)));
+			vertexAnalytic.emplace_back(vertexGrads[i][k]);
+		}
+		for (uint32_t k = 0; k < 4; k++) {
+			const float x = c[i][k];
+			c[i][k] = x + step; const double lp = cpuLoss(v, c);
+			c[i][k] = x - step; const double lm = cpuLoss(v, c);
+			c[i][k] = x;
+			colorFd.emplace_back(float((lp - lm) / (2 * step)));
+			colorAnalytic.emplace_back(colorGrads[i][k]);
+		}
+	}
+	const double vertexFdError = RelativeError(vertexAnalytic, vertexFd);
+	const double colorFdError  = RelativeError(colorAnalytic, colorFd);
+
+	const float fdTolerance = std::max(args.validateTolerance, 0.05f);
+	const bool passed =
+		imageError       <= args.validateTolerance &&
+		lossError        <= args.validateTolerance &&
+		vertexGradsError <= args.validateTolerance &&
+		colorGradsError  <= args.validateTolerance &&
+		vertexFdError    <= fdTolerance &&
+		colorFdError     <= fdTolerance;
+	failed |= !passed;
+
+	return {
+		{ "points",     pointCount },
+		{ "width",      extent.x },
+		{ "height",     extent.y },
+		{ "pointSize",  renderer.pointSize },
+		{ "loss",       loss },
+		{ "gpuLoss",    lossGpu },
+		{ "relativeError", {
+			{ "image",           imageError },
+			{ "loss",            lossError },
+			{ "vertexGradients", vertexGradsError },
+			{ "colorGradients",  colorGradsError },
+		} },
+		{ "finiteDifferenceError", {
+			{ "points",          checked.size() },
+			{ "step",            step },
+			{ "vertexGradients", vertexFdError },
+			{ "colorGradients",  colorFdError },
+		} },
+		{ "tolerance",  args.validateTolerance },
+		{ "finiteDifferenceTolerance", fdTolerance },
+		{ "passed",     passed },
+	};
+}
+
+int main(int argc, const char** argv) {
+	BenchmarkArgs args;
+	if (!args.Parse(argc, argv)) {
+		std::cerr << "Usage: " << argv[0] << " [--points N,N,...] [--resolutions WxH,WxH,...] [--views N] [--samples N] [--warmup N] [--point-scale S] [--rasterizer auto|mesh|compute] [--baseline FILE] [--tolerance T] [--device NAME] [--seed N] [--output FILE] [--validate] [--validate-tolerance T]" << std::endl;
+		return 1;
+	}
+
+	nlohmann::json baseline;
+	if (!args.baseline.empty()) {
+		std::ifstream fs(args.baseline);
+		if (!fs) {
+			std::cerr << "Failed to open " << args.baseline << std::endl;
+			return 1;
+		}
+		baseline = nlohmann::json::parse(fs);
+	}
+
+	HeadlessContext h = HeadlessContext::Create(args.device, { VK_EXT_SHADER_ATOMIC_FLOAT_EXTENSION_NAME }, { VK_EXT_MESH_SHADER_EXTENSION_NAME });
+	if (!h) return 1;
+	CommandContext& context = *h.context;
+
+	PointCloudScene    scene;
+	PointCloudRenderer renderer;
+	Trainer            trainer;
+	renderer.meshShaders = h.HasExtension(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+	if      (args.rasterizer == "mesh")    renderer.rasterMode = PointCloudRenderer::RasterMode::eMeshShader;
+	else if (args.rasterizer == "compute") renderer.rasterMode = PointCloudRenderer::RasterMode::eCompute;
+
+	if (args.validate) {
+		bool failed = false;
+		const nlohmann::json result = {
+			{ "device",     h.deviceName },
+			{ "seed",       args.seed },
+			{ "validation", Validate(h, renderer, args, failed) },
+		};
+		if (!args.output.empty())
+			std::ofstream(args.output) << result.dump(4) << std::endl;
+		std::cout << result.dump(4) << std::endl;
+		return failed ? 3 : 0;
+	}
+
+	GpuProfiler profiler(*h.device, context.QueueFamily());
+	if (!profiler.enabled) {
+		std::cerr << "The queue has no timestamp support" << std::endl;
+		return 1;
+	}
+	profiler.recordTrace = false;
+	profiler.SetActive(context);
+
+	nlohmann::json results = nlohmann::json::array();
+	std::mt19937 rng(args.seed);
+	for (const uint32_t pointCount : args.pointCounts) {
+		std::vector<float3> vertices;
+		std::vector<float4> vertexColors;
+		CreatePoints(pointCount, rng, vertices, vertexColors);
+
+		context.Begin();
+		scene.UploadPoints(context, vertices, vertexColors);
+		trainer.SaveInitialState(context, scene);
+		context.Submit();
+		h.device->Wait();
+		context.Begin();
+		renderer.pointSize = args.pointScale * 2 / std::cbrt(float(pointCount));
+
+		for (const uint2 extent : args.resolutions) {
+			std::vector<Transform> views, projections;
+			CreateCameras(args.views, extent, views, projections);
+
+			// the previous configuration's Adam steps moved the points
+			scene.pointCloud.vertices.Restore(context, trainer.initialVertices);
+			scene.pointCloud.vertexColors.Restore(context, trainer.initialVertexColors);
+			trainer.Reset();
+
+			const ImageView& target = trainer.GetRenderTarget(context, extent);
+			const ImageView  reference = ImageView::Create(
+				Image::Create(context.GetDevice(), ImageInfo{
+					.format = vk::Format::eR8G8B8A8Unorm,
+					.extent = uint3(extent, 1u),
+					.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+					.queueFamilies = { context.QueueFamily() } }));
+			context.ClearColor(reference, vk::ClearColorValue{std::array<float,4>{ 0.5f, 0.5f, 0.5f, 1 }});
+
+			std::vector<double> sortTimes, renderTimes, renderGradientsTimes, adamTimes;
+			uint32_t computeSamples = 0;
+			for (uint32_t i = 0; i < args.warmup + args.samples; i++) {
+				const Transform& view = views[i % views.size()];
+				const Transform& proj = projections[i % projections.size()];
+
+				// Render in its own submission, since RenderGradients labels its tile passes the same way.
+				// Presorted points are always drawn with mesh shaders. Otherwise, Render picks the rasterizer
+				// after reading back the footprint of earlier frames.
+				const bool presorted = !renderer.UseComputeRaster();
+				if (presorted)
+					renderer.Render(context, target, scene.pointCloud, view, proj, renderer.Sort(context, scene.pointCloud, view, proj, extent, renderer.percentToDraw));
+				else
+					renderer.Render(context, target, scene.pointCloud, view, proj);
+				const bool computeRaster = !presorted && renderer.UseComputeRaster();
+				h.Flush();
+				profiler.Update();
+				const double sortTime   = profiler.Last(computeRaster ? "Bin points" : "Sort points");
+				const double renderTime = profiler.Last(computeRaster ? "Render tiles" : "Rasterize points");
+
+				const BufferRange<float> lossBuf = context.GetTransientBuffer<float>(1, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst);
+				context.Fill(lossBuf, 0.f);
+				scene.pointCloud.vertices.clearGradients(context);
+				scene.pointCloud.vertexColors.clearGradients(context);
+				trainer.gradientsCleared = false;
+
+				GpuProfiler::PushRegion(context, "Render gradients");
+				renderer.RenderGradients(context, target, scene.pointCloud, view, proj, reference, lossBuf);
+				GpuProfiler::PopRegion(context);
+				GpuProfiler::PushRegion(context, "Adam");
+				trainer.StepAdam(context, scene);
+				GpuProfiler::PopRegion(context);
+				h.Flush();
+				profiler.Update();
+
+				if (i < args.warmup) continue;
+				if (computeRaster) computeSamples++;
+				sortTimes.emplace_back(sortTime);
+				renderTimes.emplace_back(renderTime);
+				renderGradientsTimes.emplace_back(profiler.Last("Render gradients"));
+				adamTimes.emplace_back(profiler.Last("Adam"));
+			}
+
+			results.push_back({
+				{ "points",     pointCount },
+				{ "width",      extent.x },
+				{ "height",     extent.y },
+				{ "pointSize",  renderer.pointSize },
+				{ "rasterizer", computeSamples == args.samples ? "compute" : computeSamples == 0 ? "mesh" : "mixed" },
+				{ "passMilliseconds", {
+					{ "sort",            GetStatistics(sortTimes) },
+					{ "render",          GetStatistics(renderTimes) },
+					{ "renderGradients", GetStatistics(renderGradientsTimes) },
+					{ "adam",            GetStatistics(adamTimes) },
+				} },
+			});
+			std::cerr << pointCount << " points, " << extent.x << "x" << extent.y << " done" << std::endl;
+		}
+		context.Submit();
+		h.device->Wait();
+	}
+
+	nlohmann::json result = {
+		{ "device",  h.deviceName },
+		{ "timing",  "gpu" },
+		{ "samples", args.samples },
+		{ "views",   args.views },
+		{ "seed",    args.seed },
+		{ "results", results },
+	};
+
+	bool regressed = false;
+	if (!baseline.is_null()) {
+		result["baseline"]   = args.baseline.string();
+		result["comparison"] = CompareToBaseline(result, baseline, args.tolerance, regressed);
+		result["regressed"]  = regressed;
+	}
+
+	if (!args.output.empty())
+		std::ofstream(args.output) << result.dump(4) << std::endl;
+	std::cout << result.dump(4) << std::endl;
+	return regressed ? 2 : 0;
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <optional>
+#include <queue>
+
+#include <Rose/Core/CommandContext.hpp>
+#include <Rose/Core/PipelineCache.hpp>
+
+#include "Scene/PointCloudScene.hpp"
+#include "PrefixSum/PrefixSum.hpp"
+#include "GpuProfiler.hpp"
+#include "ShaderPrecompiler.hpp"
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Grows and shrinks a point cloud during training (see Densify.cs.slang).
+// Point statistics accumulate on the GPU every step. Every `interval` iterations the points are classified and
+// their output offsets prefix summed; once the new point count has been read back, a later step reallocates the
+// point cloud and compacts the points into it, so densification never waits on the GPU.
+struct DensityControl {
+	PipelineCache accumulateStats = PipelineCache(FindShaderPath("Densify.cs.slang"), "accumulateStats");
+	PipelineCache classifyPoints  = PipelineCache(FindShaderPath("Densify.cs.slang"), "classifyPoints");
+	PipelineCache compactPoints   = PipelineCache(FindShaderPath("Densify.cs.slang"), "compactPoints");
+	PrefixSum prefixSum;
+
+	bool     enabled = false;
+	uint32_t interval       = 100;   // iterations between densification steps
+	uint32_t startIteration = 500;
+	uint32_t stopIteration  = 15000;
+	float    gradientThreshold = 2e-4f; // mean position gradient norm above which points are cloned or split
+	float    minOpacity     = 0.005f;   // points below this alpha are pruned
+	float    splitDistance  = 0.5f;     // distance to move new points by, relative to the point size
+	uint32_t maxPoints      = 4'000'000;
+
+	// results of the last densification step
+	uint32_t lastPruned = 0;
+	uint32_t lastAdded  = 0;
+
+	BufferRange<float4>   gradientStats;
+	BufferRange<uint32_t> visibleCounts;
+
+	struct PendingCompaction {
+		BufferRange<uint32_t> actions;
+		BufferRange<uint32_t> keepOffsets;
+		BufferRange<uint32_t> newOffsets;
+		BufferRange<uint32_t> countsCpu; // kept and new point counts
+		uint32_t vertexCount;
+		uint64_t timelineValue;
+	};
+	std::optional<PendingCompaction> pending;
+	std::queue<std::pair<PointCloud, uint64_t>> retiredPointClouds; // kept alive until work using them completes
+
+	inline void Reset() {
+		pending.reset();
+		gradientStats = {};
+		visibleCounts = {};
+		lastPruned = 0;
+		lastAdded  = 0;
+	}
+
+	inline void DrawGui() {
+		ImGui::Checkbox("Enable", &enabled);
+		ImGui::DragScalar("Interval", ImGuiDataType_U32, &interval);
+		ImGui::DragScalar("Start iteration", ImGuiDataType_U32, &startIteration);
+		ImGui::DragScalar("Stop iteration", ImGuiDataType_U32, &stopIteration);
+		ImGui::DragFloat("Gradient threshold", &gradientThreshold, 1e-5f, 0, 1, "%.6f");
+		ImGui::DragFloat("Min opacity", &minOpacity, 0.001f, 0, 1);
+		ImGui::DragFloat("Split distance", &splitDistance, 0.01f, 0, 10);
+		ImGui::DragScalar("Max points", ImGuiDataType_U32, &maxPoints);
+		ImGui::Text("Last step: +%u, -%u points", lastAdded, lastPruned);
+	}
+
+	inline void Precompile(ShaderPrecompiler& precompiler) {
+		precompiler.Add(accumulateStats);
+		precompiler.Add(classifyPoints);
+		precompiler.Add(compactPoints);
+		prefixSum.Precompile(precompiler);
+	}
+
+	inline ShaderParameter GetShaderParameters(const PointCloud& pointCloud) const {
+		ShaderParameter params = {};
+		params["pointCloud"]    = pointCloud.GetShaderParameter();
+		params["gradientStats"] = (BufferParameter)gradientStats;
+		params["visibleCounts"] = (BufferParameter)visibleCounts;
+		return params;
+	}
+
+	inline void ResetStatistics(CommandContext& context, const uint32_t vertexCount) {
+		gradientStats = SharedQueueFamilies::CreateBuffer(context.GetDevice(), std::max(vertexCount, 1u)*sizeof(float4), vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst).cast<float4>();
+		visibleCounts = SharedQueueFamilies::CreateBuffer(context.GetDevice(), std::max(vertexCount, 1u)*sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst).cast<uint32_t>();
+		context.Fill(gradientStats.cast<uint32_t>(), 0u);
+		context.Fill(visibleCounts, 0u);
+	}
+
+	// Accumulates the statistics of the gradients in pointCloud. Call after the backward pass, before Adam consumes them.
+	inline void AccumulateStatistics(CommandContext& context, const PointCloud& pointCloud) {
+		const uint32_t vertexCount = (uint32_t)pointCloud.size();
+		if (vertexCount == 0) return;
+		if (!gradientStats || gradientStats.size() != vertexCount)
+			ResetStatistics(context, vertexCount);
+		accumulateStats(context, uint3(vertexCount, 1, 1), GetShaderParameters(pointCloud));
+	}
+
+	// Classifies the points on densification iterations, and reallocates the point cloud once a pending
+	// classification's counts are available. Returns true if pointCloud was replaced.
+	inline bool Update(CommandContext& context, PointCloud& pointCloud, const uint32_t iteration, const float pointSize) {
+		const Device& device = context.GetDevice();
+		while (!retiredPointClouds.empty() && ContextTimeline::CurrentValue(context) >= retiredPointClouds.front().second)
+			retiredPointClouds.pop();
+
+		const uint32_t vertexCount = (uint32_t)pointCloud.size();
+		if (!gradientStats || gradientStats.size() != vertexCount) return false;
+
+		if (pending) {
+			if (ContextTimeline::CurrentValue(context) < pending->timelineValue) return false;
+			if (pending->vertexCount == vertexCount) {
+				Compact(context, pointCloud, *pending, pointSize);
+				pending.reset();
+				return true;
+			}
+			pending.reset();
+		}
+
+		if (!enabled || iteration < startIteration || iteration > stopIteration || interval == 0 || (iteration % interval) != 0)
+			return false;
+
+		GpuProfiler::PushRegion(context, "Classify points");
+
+		PendingCompaction p = {
+			.actions     = SharedQueueFamilies::CreateBuffer(device, vertexCount*sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer).cast<uint32_t>(),
+			.keepOffsets = SharedQueueFamilies::CreateBuffer(device, (vertexCount + 1)*sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst).cast<uint32_t>(),
+			.newOffsets  = SharedQueueFamilies::CreateBuffer(device, (vertexCount + 1)*sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst).cast<uint32_t>(),
+			.countsCpu   = Buffer::Create(device, 2*sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent, VMA_ALLOCATION_CREATE_MAPPED_BIT|VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT),
+			.vertexCount = vertexCount };
+
+		// the trailing 0 becomes the total after the scan
+		context.Fill(p.keepOffsets.slice(vertexCount, 1), 0u);
+		context.Fill(p.newOffsets.slice(vertexCount, 1), 0u);
+
+		ShaderParameter params = GetShaderParameters(pointCloud);
+		params["actions"]           = (BufferParameter)p.actions;
+		params["keepOffsets"]       = (BufferParameter)p.keepOffsets;
+		params["newOffsets"]        = (BufferParameter)p.newOffsets;
+		params["gradientThreshold"] = gradientThreshold;
+		params["minOpacity"]        = minOpacity;
+		classifyPoints(context, uint3(vertexCount, 1, 1), params);
+		prefixSum(context, p.keepOffsets);
+		prefixSum(context, p.newOffsets);
+
+		context.Copy(p.keepOffsets.slice(vertexCount, 1), p.countsCpu.slice(0, 1));
+		context.Copy(p.newOffsets.slice(vertexCount, 1),  p.countsCpu.slice(1, 1));
+		p.timelineValue = ContextTimeline::NextSignal(context);
+		pending = p;
+
+		GpuProfiler::PopRegion(context);
+		return false;
+	}
+
+	inline void Compact(CommandContext& context, PointCloud& pointCloud, const PendingCompaction& p, const float pointSize) {
+		const uint32_t keptCount = p.countsCpu[0];
+		const uint32_t newCount  = std::min(p.countsCpu[1], maxPoints > keptCount ? maxPoints - keptCount : 0u);
+		lastPruned = p.vertexCount - keptCount;
+		lastAdded  = newCount;
+
+		GpuProfiler::PushRegion(context, "Compact points");
+
+		PointCloud dst = {
+			.vertices     = BufferGradient<3>::Allocate(context, keptCount + newCount, pointCloud.vertices.format),
+			.vertexColors = BufferGradient<4>::Allocate(context, keptCount + newCount, pointCloud.vertexColors.format) };
+
+		ShaderParameter params = GetShaderParameters(pointCloud);
+		params["dstPointCloud"]  = dst.GetShaderParameter();
+		params["actions"]        = (BufferParameter)p.actions;
+		params["keepOffsets"]    = (BufferParameter)p.keepOffsets;
+		params["newOffsets"]     = (BufferParameter)p.newOffsets;
+		params["splitDistance"]  = splitDistance * pointSize;
+		compactPoints(context, uint3(p.vertexCount, 1, 1), params);
+
+		retiredPointClouds.push({ std::move(pointCloud), ContextTimeline::NextSignal(context) });
+		pointCloud = std::move(dst);
+		ResetStatistics(context, keptCount + newCount);
+
+		GpuProfiler::PopRegion(context);
+	}
+};
+
+}
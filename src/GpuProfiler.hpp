@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <imgui/imgui.h>
+#include <json.hpp>
+#include <Rose/Core/CommandContext.hpp>
+
+#include "QueueSync.hpp"
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Times labelled GPU regions with timestamp queries.
+// PushRegion/PopRegion push a debug label and, if a profiler is active on the context, write a timestamp pair around
+// the region. Each context has its own active profiler, so regions of contexts on different queues (e.g. the
+// viewport and the async trainer) are never merged into one set of statistics.
+// Queries are allocated from pools that are closed once their commands are submitted, and read back once the
+// submission's timeline value has been reached, so resolving results never waits on the GPU.
+class GpuProfiler {
+private:
+	static constexpr uint32_t kQueriesPerPool = 1024;
+
+	// Stored in the pool of its begin query. Its end query may be in a later pool, if the region outlived a full pool.
+	struct Region {
+		std::string name;
+		uint32_t    depth;
+		uint32_t    beginQuery;
+		uint64_t    endPool = 0; // id of the pool of the end query, 0 while the region is open
+		uint32_t    endQuery = 0;
+	};
+	struct QueryPool {
+		vk::raii::QueryPool   pool = nullptr;
+		uint64_t              id = 0;
+		std::vector<Region>   regions;
+		uint32_t              queryCount = 0;
+		uint64_t              timelineValue = 0; // signalled by the submission that wrote the queries
+		const CommandContext* context = nullptr;   // whose timeline timelineValue is on
+	};
+	struct RegionStats {
+		std::deque<double> samples; // milliseconds, most recent last
+		double   last  = 0;
+		uint32_t depth = 0;
+	};
+	struct TraceEvent {
+		std::string name;
+		double      start; // microseconds
+		double      duration;
+		uint32_t    depth;
+	};
+
+	std::deque<QueryPool>  mPools;     // oldest first, the back one is being recorded into
+	std::vector<QueryPool> mFreePools;
+	std::vector<std::pair<uint64_t, size_t>> mOpenRegions; // pool id and index into its regions
+	uint64_t mNextPoolId = 1;
+	double   mTimestampPeriod = 1; // nanoseconds per tick
+	uint64_t mTimestampMask   = ~0ull;
+	std::optional<uint64_t> mTraceOrigin;
+
+	std::vector<std::string> mRegionOrder; // by first appearance, for a stable GUI
+	std::unordered_map<std::string, RegionStats> mStats;
+	std::deque<TraceEvent> mTrace;
+
+	inline static std::unordered_map<const CommandContext*, GpuProfiler*> sActive;
+
+	inline QueryPool* FindPool(const uint64_t id) {
+		const auto it = std::ranges::find(mPools, id, &QueryPool::id);
+		return it == mPools.end() ? nullptr : &*it;
+	}
+
+	// Whether the pool's queries were submitted and completed. The recording pool is not, while regions are open.
+	inline bool IsComplete(const QueryPool& p) const {
+		if (&p == &mPools.back() && !mOpenRegions.empty()) return false;
+		return !p.context || ContextTimeline::CurrentValue(*p.context) >= p.timelineValue;
+	}
+
+	inline QueryPool& GetRecordingPool(CommandContext& context) {
+		// the recording pool is closed once its commands were submitted, or when it is full. A full pool is
+		// closed even while regions are open, and their end queries go to the next pool.
+		const uint64_t timelineValue = ContextTimeline::NextSignal(context);
+		if (mPools.empty() || mPools.back().queryCount + 1 > kQueriesPerPool ||
+			(mOpenRegions.empty() && (mPools.back().context != &context || mPools.back().timelineValue != timelineValue)))
+			mPools.emplace_back();
+
+		QueryPool& p = mPools.back();
+		if (!*p.pool) {
+			if (!mFreePools.empty()) {
+				p = std::move(mFreePools.back());
+				mFreePools.pop_back();
+			} else
+				p.pool = vk::raii::QueryPool(*context.GetDevice(), vk::QueryPoolCreateInfo{
+					.queryType  = vk::QueryType::eTimestamp,
+					.queryCount = kQueriesPerPool });
+			p.id = mNextPoolId++;
+			p.regions.clear();
+			p.queryCount = 0;
+			context->resetQueryPool(*p.pool, 0, kQueriesPerPool);
+		}
+		p.timelineValue = timelineValue;
+		p.context       = &context;
+		return p;
+	}
+
+	inline void AddSample(const Region& r, const uint64_t begin, const uint64_t end) {
+		const uint64_t ticks = (end - begin) & mTimestampMask;
+		const double ms = ticks * mTimestampPeriod * 1e-6;
+
+		auto [it, inserted] = mStats.try_emplace(r.name);
+		if (inserted) mRegionOrder.emplace_back(r.name);
+		RegionStats& s = it->second;
+		s.last  = ms;
+		s.depth = r.depth;
+		s.samples.emplace_back(ms);
+		while (s.samples.size() > windowSize) s.samples.pop_front();
+
+		if (recordTrace) {
+			if (!mTraceOrigin) mTraceOrigin = begin;
+			mTrace.emplace_back(TraceEvent{
+				.name     = r.name,
+				.start    = ((begin - *mTraceOrigin) & mTimestampMask) * mTimestampPeriod * 1e-3,
+				.duration = ms * 1e3,
+				.depth    = r.depth });
+			while (mTrace.size() > maxTraceEvents) mTrace.pop_front();
+		}
+	}
+
+public:
+	bool     enabled = true;
+	bool     recordTrace = true;
+	uint32_t windowSize = 64; // samples averaged per region
+	size_t   maxTraceEvents = 1 << 18;
+
+	GpuProfiler() = default;
+	GpuProfiler(const GpuProfiler&) = delete;
+	GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+	inline GpuProfiler(const Device& device, const uint32_t queueFamily) {
+		mTimestampPeriod = device.PhysicalDevice().getProperties().limits.timestampPeriod;
+		const uint32_t validBits = device.PhysicalDevice().getQueueFamilyProperties()[queueFamily].timestampValidBits;
+		enabled = validBits > 0;
+		mTimestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+	}
+	inline ~GpuProfiler() { std::erase_if(sActive, [&](const auto& p) { return p.second == this; }); }
+
+	// Regions pushed through PushRegion on context are recorded by this profiler
+	inline void SetActive(const CommandContext& context) { sActive[&context] = this; }
+	inline static GpuProfiler* Active(const CommandContext& context) {
+		const auto it = sActive.find(&context);
+		return it == sActive.end() ? nullptr : it->second;
+	}
+
+	inline static void PushRegion(CommandContext& context, const std::string& name) {
+		context.PushDebugLabel(name);
+		if (GpuProfiler* p = Active(context); p && p->enabled) p->Begin(context, name);
+	}
+	inline static void PopRegion(CommandContext& context) {
+		if (GpuProfiler* p = Active(context); p && !p->mOpenRegions.empty()) p->End(context);
+		context.PopDebugLabel();
+	}
+
+	inline void Begin(CommandContext& context, const std::string& name) {
+		QueryPool& p = GetRecordingPool(context);
+		mOpenRegions.emplace_back(p.id, p.regions.size());
+		p.regions.emplace_back(Region{ .name = name, .depth = (uint32_t)mOpenRegions.size() - 1, .beginQuery = p.queryCount });
+		context->writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, *p.pool, p.queryCount);
+		p.queryCount++;
+	}
+	inline void End(CommandContext& context) {
+		const auto [poolId, regionIndex] = mOpenRegions.back();
+		QueryPool& p = GetRecordingPool(context);
+		mOpenRegions.pop_back();
+		if (QueryPool* beginPool = FindPool(poolId)) {
+			Region& r = beginPool->regions[regionIndex];
+			r.endPool  = p.id;
+			r.endQuery = p.queryCount;
+		}
+		context->writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, *p.pool, p.queryCount);
+		p.queryCount++;
+	}
+
+	// Reads back the pools whose submissions have completed. Does not block.
+	inline void Update() {
+		while (!mPools.empty() && IsComplete(mPools.front())) {
+			QueryPool& p = mPools.front();
+
+			// regions that ended in later pools need those completed too
+			bool ready = true;
+			for (const Region& r : p.regions) {
+				const QueryPool* endPool = r.endPool == p.id ? &p : FindPool(r.endPool);
+				ready &= endPool && IsComplete(*endPool);
+			}
+			if (!ready) break;
+
+			if (p.queryCount > 0) {
+				const auto [result, timestamps] = p.pool.getResults<uint64_t>(0, p.queryCount, p.queryCount * sizeof(uint64_t), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+				if (result == vk::Result::eSuccess) {
+					for (const Region& r : p.regions) {
+						if (r.endPool == p.id) {
+							AddSample(r, timestamps[r.beginQuery], timestamps[r.endQuery]);
+							continue;
+						}
+						const auto [endResult, end] = FindPool(r.endPool)->pool.getResult<uint64_t>(r.endQuery, 1, sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+						if (endResult == vk::Result::eSuccess)
+							AddSample(r, timestamps[r.beginQuery], end);
+					}
+				}
+			}
+			mFreePools.emplace_back(std::move(p));
+			mPools.pop_front();
+		}
+	}
+
+	// Mean of the last windowSize samples of a region, in milliseconds. 0 if it was never recorded.
+	inline double Average(const std::string& name) const {
+		const auto it = mStats.find(name);
+		if (it == mStats.end() || it->second.samples.empty()) return 0;
+		double sum = 0;
+		for (const double s : it->second.samples) sum += s;
+		return sum / it->second.samples.size();
+	}
+
+	// Most recent sample of a region, in milliseconds. 0 if it was never recorded.
+	inline double Last(const std::string& name) const {
+		const auto it = mStats.find(name);
+		return it == mStats.end() ? 0 : it->second.last;
+	}
+
+	inline void Clear() {
+		mStats.clear();
+		mRegionOrder.clear();
+		mTrace.clear();
+		mTraceOrigin.reset();
+	}
+
+	// Writes the recorded regions in the Chrome trace event format (chrome://tracing, ui.perfetto.dev)
+	inline bool WriteChromeTrace(const std::filesystem::path& path) const {
+		nlohmann::json events = nlohmann::json::array();
+		for (const TraceEvent& e : mTrace)
+			events.emplace_back(nlohmann::json{
+				{ "name", e.name },
+				{ "ph",   "X" },
+				{ "ts",   e.start },
+				{ "dur",  e.duration },
+				{ "pid",  0 },
+				{ "tid",  0 },
+				{ "args", { { "depth", e.depth } } } });
+		std::ofstream file(path);
+		if (!file) return false;
+		file << nlohmann::json{ { "traceEvents", events }, { "displayTimeUnit", "ms" } }.dump();
+		return (bool)file;
+	}
+
+	inline nlohmann::json AveragesJson() const {
+		nlohmann::json r = nlohmann::json::object();
+		for (const std::string& name : mRegionOrder)
+			r[name] = Average(name);
+		return r;
+	}
+
+	inline void DrawGui() {
+		ImGui::Checkbox("Enable", &enabled);
+		ImGui::SameLine();
+		if (ImGui::Button("Clear")) Clear();
+		ImGui::Checkbox("Record trace", &recordTrace);
+		if (!mTrace.empty()) {
+			ImGui::SameLine();
+			if (ImGui::Button("Save trace"))
+				WriteChromeTrace("vkgsplat-trace.json");
+			ImGui::SameLine();
+			ImGui::Text("%zu events", mTrace.size());
+		}
+
+		if (ImGui::BeginTable("GPU timings", 3, ImGuiTableFlags_RowBg)) {
+			ImGui::TableSetupColumn("Region");
+			ImGui::TableSetupColumn("Avg (ms)");
+			ImGui::TableSetupColumn("Last (ms)");
+			ImGui::TableHeadersRow();
+			for (const std::string& name : mRegionOrder) {
+				const RegionStats& s = mStats.at(name);
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::Indent(s.depth * ImGui::GetStyle().IndentSpacing);
+				ImGui::TextUnformatted(name.c_str());
+				ImGui::Unindent(s.depth * ImGui::GetStyle().IndentSpacing);
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", Average(name));
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", s.last);
+			}
+			ImGui::EndTable();
+		}
+	}
+};
+
+}
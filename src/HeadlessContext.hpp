@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <Rose/Core/CommandContext.hpp>
+#include <Rose/Core/Instance.hpp>
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Vulkan instance, device and compute context without a window or swapchain.
+// Used by the headless trainer and benchmarks; runs on software drivers such as lavapipe.
+struct HeadlessContext {
+	ref<Instance>       instance;
+	ref<Device>         device;
+	ref<CommandContext> context;
+	std::string         deviceName;
+	std::vector<std::string> extensions; // enabled device extensions
+
+	// Picks the first physical device whose name contains deviceName (or the first device if empty),
+	// preferring discrete GPUs when no name is given. Optional extensions are enabled if the device supports them.
+	inline static HeadlessContext Create(const std::string& deviceName = "", const vk::ArrayProxy<const std::string>& deviceExtensions = {}, const std::vector<std::string>& optionalExtensions = {}) {
+		HeadlessContext h;
+		h.instance = Instance::Create({}, {});
+
+		vk::raii::PhysicalDevices physicalDevices(**h.instance);
+		const vk::raii::PhysicalDevice* physicalDevice = nullptr;
+		for (const vk::raii::PhysicalDevice& pd : physicalDevices) {
+			const vk::PhysicalDeviceProperties props = pd.getProperties();
+			const std::string name = props.deviceName.data();
+			if (!deviceName.empty()) {
+				if (name.find(deviceName) == std::string::npos) continue;
+			} else if (physicalDevice && props.deviceType != vk::PhysicalDeviceType::eDiscreteGpu)
+				continue;
+			physicalDevice = &pd;
+			if (!deviceName.empty() || props.deviceType == vk::PhysicalDeviceType::eDiscreteGpu) break;
+		}
+		if (!physicalDevice) {
+			std::cerr << "No Vulkan device matching \"" << deviceName << "\"" << std::endl;
+			return {};
+		}
+
+		h.deviceName = physicalDevice->getProperties().deviceName.data();
+		h.extensions.assign(deviceExtensions.begin(), deviceExtensions.end());
+		const auto supported = physicalDevice->enumerateDeviceExtensionProperties();
+		for (const std::string& e : optionalExtensions)
+			if (std::ranges::any_of(supported, [&](const vk::ExtensionProperties& p) { return e == p.extensionName.data(); }))
+				h.extensions.emplace_back(e);
+		h.device = Device::Create(*h.instance, *physicalDevice, h.extensions);
+
+		uint32_t queueFamily = 0;
+		const auto queueFamilies = physicalDevice->getQueueFamilyProperties();
+		for (uint32_t i = 0; i < queueFamilies.size(); i++) {
+			if (queueFamilies[i].queueFlags & vk::QueueFlagBits::eCompute) {
+				queueFamily = i;
+				break;
+			}
+		}
+		h.context = CommandContext::Create(h.device, queueFamily);
+		return h;
+	}
+
+	inline operator bool() const { return context != nullptr; }
+
+	inline bool HasExtension(const std::string& name) const { return std::ranges::find(extensions, name) != extensions.end(); }
+
+	// Submits the recorded work, blocks until it completes and begins recording again.
+	inline void Flush() {
+		context->Submit();
+		device->Wait();
+		context->Begin();
+	}
+
+	// Wall-clock milliseconds of GPU work recorded by fn, including submission and synchronization.
+	template<typename F>
+	inline double Time(F&& fn) {
+		Flush();
+		const auto t0 = std::chrono::high_resolution_clock::now();
+		fn(*context);
+		Flush();
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+	}
+};
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Rose/Core/CommandContext.hpp>
+#include <Rose/Core/PipelineCache.hpp>
+
+#include "PrefixSum/PrefixSum.hpp"
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Stable radix sort of (key, value) pairs by the low keyBits bits of the key, one pass per 8 bits.
+// Sorting narrow keys this way takes fewer passes over the pairs than a full 32 bit sort.
+struct KeySort {
+	static constexpr uint32_t kBlockSize = 1024; // BLOCK_SIZE in KeySort.cs.slang
+	static constexpr uint32_t kRadix     = 256;  // RADIX in KeySort.cs.slang
+
+	PipelineCache countDigits  = PipelineCache(FindShaderPath("KeySort.cs.slang"), "countDigits");
+	PipelineCache scatterPairs = PipelineCache(FindShaderPath("KeySort.cs.slang"), "scatterPairs");
+	PrefixSum prefixSum;
+
+	inline void Precompile(ShaderPrecompiler& precompiler) {
+		precompiler.Add(countDigits);
+		precompiler.Add(scatterPairs);
+		prefixSum.Precompile(precompiler);
+	}
+
+	inline void operator()(CommandContext& context, const BufferRange<uint2>& pairs, const uint32_t keyBits) {
+		const uint32_t count = (uint32_t)pairs.size();
+		if (count <= 1) return;
+
+		const uint32_t numBlocks = (count + kBlockSize - 1) / kBlockSize;
+		const BufferRange<uint32_t> blockCounts = context.GetTransientBuffer<uint32_t>(kRadix * numBlocks, vk::BufferUsageFlagBits::eStorageBuffer);
+		const BufferRange<uint2>    tmp         = context.GetTransientBuffer<uint2>(count, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc);
+
+		const uint32_t passes = (keyBits + 7) / 8;
+		for (uint32_t pass = 0; pass < passes; pass++) {
+			const BufferRange<uint2>& src = pass % 2 == 0 ? pairs : tmp;
+			const BufferRange<uint2>& dst = pass % 2 == 0 ? tmp : pairs;
+			ShaderParameter params = {};
+			params["pairs"]       = (BufferParameter)src;
+			params["sortedPairs"] = (BufferParameter)dst;
+			params["blockCounts"] = (BufferParameter)blockCounts;
+			params["count"]       = count;
+			params["numBlocks"]   = numBlocks;
+			params["shift"]       = pass * 8;
+			countDigits(context, uint3(numBlocks * (kBlockSize/4), 1, 1), params);
+			prefixSum(context, blockCounts);
+			scatterPairs(context, uint3(numBlocks * (kBlockSize/4), 1, 1), params);
+		}
+		if (passes % 2 == 1)
+			context.Copy(tmp, pairs);
+	}
+};
+
+}
@@ -0,0 +1,382 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <numeric>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <Rose/Core/CommandContext.hpp>
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// CPU implementation of PointCloudRenderer::Render and RenderGradients, with hand-written derivatives of the
+// functions in Splat.slang. Used to validate the GPU kernels and to run tiny scenes without a GPU.
+//
+// Points are sorted by depth and binned into 16x16 pixel tiles. Tiles are split across threads, and each
+// thread shades a tile row in packets of kLanes pixels, with the per-lane loops written to auto-vectorize.
+// Gradients are accumulated per thread and reduced in thread order, so results are deterministic for a
+// given thread count.
+struct CpuPointCloudRenderer {
+	static constexpr uint32_t kTileSize = 16;
+	static constexpr uint32_t kLanes    = 8;
+	static_assert(kTileSize % kLanes == 0);
+
+	struct Camera {
+		float4x4 view;
+		float4x4 projection;
+		uint2    outputExtent;
+		float    pointSize;
+	};
+
+	// Point data in the same layout as PointCloud's buffers
+	struct PointCloud {
+		std::span<const float3> vertices;
+		std::span<const float4> colors;
+	};
+	struct PointCloudGradients {
+		std::span<float3> vertices;
+		std::span<float4> colors;
+	};
+
+	// Pixels are row-major. Rendered images store transmittance in alpha, like the GPU renderer's output.
+	struct Image {
+		uint2 extent = uint2(0);
+		std::vector<float4> pixels;
+
+		inline float4&       operator[](const uint2 p)       { return pixels[size_t(p.y) * extent.x + p.x]; }
+		inline const float4& operator[](const uint2 p) const { return pixels[size_t(p.y) * extent.x + p.x]; }
+	};
+
+	float    pointSize  = 1;
+	uint32_t numThreads = 0; // 0 = hardware concurrency
+
+	// projectPoint in Splat.slang
+	inline static float3 ProjectPoint(const Camera& camera, const float3 vertex) {
+		const float3 viewVertex = float3(camera.view * float4(vertex, 1));
+		const float4 ndc = camera.projection * float4(viewVertex, 1);
+		if (viewVertex.z * camera.projection[2][2] < 0 || ndc.w == 0 || glm::any(glm::isnan(ndc)))
+			return float3(0);
+		const float ndcZ = ndc.z / ndc.w;
+		if (ndcZ < 0 || ndcZ > 1)
+			return float3(0);
+		const float s = (camera.pointSize/2) * std::max(std::abs(camera.outputExtent.x*camera.projection[0][0]), std::abs(camera.outputExtent.y*camera.projection[1][1])) / std::abs(viewVertex.z);
+		const float2 uv = (float2(ndc) / ndc.w) * 0.5f + 0.5f;
+		return float3(uv * float2(camera.outputExtent), s);
+	}
+
+	// Backward of ProjectPoint with respect to the vertex
+	inline static float3 ProjectPointBwd(const Camera& camera, const float3 vertex, const float3 d_splat) {
+		const float3 viewVertex = float3(camera.view * float4(vertex, 1));
+		const float4 ndc = camera.projection * float4(viewVertex, 1);
+		if (viewVertex.z * camera.projection[2][2] < 0 || ndc.w == 0 || glm::any(glm::isnan(ndc)))
+			return float3(0);
+		const float ndcZ = ndc.z / ndc.w;
+		if (ndcZ < 0 || ndcZ > 1)
+			return float3(0);
+		const float k = (camera.pointSize/2) * std::max(std::abs(camera.outputExtent.x*camera.projection[0][0]), std::abs(camera.outputExtent.y*camera.projection[1][1]));
+
+		// uv * extent = (ndc.xy / ndc.w * 0.5 + 0.5) * extent
+		const float2 d_ndcxy = float2(d_splat) * float2(camera.outputExtent) * 0.5f / ndc.w;
+		const float4 d_ndc = float4(d_ndcxy, 0, -glm::dot(d_ndcxy, float2(ndc)) / ndc.w);
+
+		float3 d_viewVertex = float3(glm::transpose(camera.projection) * d_ndc);
+		// s = k / |z|
+		d_viewVertex.z += d_splat.z * -k * (viewVertex.z < 0 ? -1.f : 1.f) / (viewVertex.z * viewVertex.z);
+
+		return float3(glm::transpose(camera.view) * float4(d_viewVertex, 0));
+	}
+
+	// splatPixelBounds in Splat.slang
+	inline static int4 SplatPixelBounds(const float3 splat) {
+		return int4(int2(glm::floor(float2(splat) - splat.z)), int2(glm::ceil(float2(splat) + splat.z)) - 1);
+	}
+
+	// Splat parameters shared by every lane of a packet
+	struct SplatData {
+		float2 center;
+		float  s;
+		float2 floorMin; // floor(center - s)
+		float2 ceilMax;  // ceil(center + s)
+		float4 color;
+	};
+
+	inline static SplatData GetSplatData(const float3 splat, const float4 color) {
+		return SplatData{
+			.center   = float2(splat),
+			.s        = splat.z,
+			.floorMin = glm::floor(float2(splat) - splat.z),
+			.ceilMax  = glm::ceil (float2(splat) + splat.z),
+			.color    = color };
+	}
+
+	// Lane mask and gaussian weight of evalSplat for a packet of pixels starting at (x0, y)
+	inline static bool EvalSplatWeights(const SplatData& sd, const uint32_t x0, const uint32_t y, float (&weight)[kLanes], bool (&covered)[kLanes]) {
+		const float py = y + 0.5f;
+		if (!(sd.s > 0) || y < sd.floorMin.y || y + 1 > sd.ceilMax.y)
+			return false;
+		const float dy = (py - sd.center.y) / sd.s;
+		bool anyCovered = false;
+		for (uint32_t l = 0; l < kLanes; l++) {
+			const float x = float(x0 + l);
+			const float dx = (x + 0.5f - sd.center.x) / sd.s;
+			covered[l] = x >= sd.floorMin.x && x + 1 <= sd.ceilMax.x;
+			weight[l] = std::exp(-5 * (dx*dx + dy*dy));
+			anyCovered |= covered[l];
+		}
+		return anyCovered;
+	}
+
+	// Points sorted front to back and binned by tile, as (tile, depth) keys in the tiled GPU renderer
+	struct Bins {
+		uint2 tileCount;
+		std::vector<float3>   splats;
+		std::vector<uint32_t> tileOffsets; // tileCount.x*tileCount.y + 1 offsets into tilePoints
+		std::vector<uint32_t> tilePoints;
+	};
+
+	inline uint32_t ThreadCount() const {
+		return numThreads ? numThreads : std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	// Runs fn(threadIndex, i) for i in [0, count), interleaving work items between threads
+	template<typename F>
+	inline void ParallelFor(const uint32_t count, F&& fn) const {
+		const uint32_t threadCount = std::min(ThreadCount(), std::max(count, 1u));
+		if (threadCount <= 1) {
+			for (uint32_t i = 0; i < count; i++) fn(0u, i);
+			return;
+		}
+		std::vector<std::jthread> threads;
+		threads.reserve(threadCount);
+		for (uint32_t t = 0; t < threadCount; t++)
+			threads.emplace_back([&, t]() {
+				for (uint32_t i = t; i < count; i += threadCount) fn(t, i);
+			});
+	}
+
+	inline Bins BinPoints(const PointCloud& pointCloud, const Camera& camera) const {
+		const uint32_t n = (uint32_t)pointCloud.vertices.size();
+		const float zSign = camera.projection[2][2] > 0 ? 1.f : -1.f;
+
+		Bins bins;
+		bins.tileCount = (camera.outputExtent + kTileSize - 1u) / kTileSize;
+		bins.splats.resize(n);
+
+		std::vector<std::pair<float, uint32_t>> keys(n);
+		ParallelFor((n + 4095) / 4096, [&](uint32_t, const uint32_t block) {
+			for (uint32_t i = block*4096; i < std::min(n, (block + 1)*4096); i++) {
+				bins.splats[i] = ProjectPoint(camera, pointCloud.vertices[i]);
+				keys[i] = { zSign * (camera.view * float4(pointCloud.vertices[i], 1)).z, i };
+			}
+		});
+
+		// same culling as CreateSortPairs
+		std::erase_if(keys, [&](const auto& k) {
+			const float3 splat = bins.splats[k.second];
+			if (!std::isfinite(k.first) || !(splat.z > 0)) return true;
+			const int4 b = SplatPixelBounds(splat);
+			return b.z < 0 || b.w < 0 || b.x >= int(camera.outputExtent.x) || b.y >= int(camera.outputExtent.y);
+		});
+		std::sort(keys.begin(), keys.end());
+
+		const uint32_t numTiles = bins.tileCount.x * bins.tileCount.y;
+		bins.tileOffsets.assign(numTiles + 1, 0);
+		auto forEachTile = [&](const float3 splat, auto&& fn) {
+			const int4 b = SplatPixelBounds(splat);
+			const uint2 tileMin = uint2(glm::max(int2(b.x, b.y), 0)) / kTileSize;
+			const uint2 tileMax = uint2(glm::min(int2(b.z, b.w), int2(camera.outputExtent) - 1)) / kTileSize;
+			for (uint32_t y = tileMin.y; y <= tileMax.y; y++)
+				for (uint32_t x = tileMin.x; x <= tileMax.x; x++)
+					fn(y * bins.tileCount.x + x);
+		};
+		for (const auto& [key, i] : keys)
+			forEachTile(bins.splats[i], [&](const uint32_t tile) { bins.tileOffsets[tile + 1]++; });
+		std::inclusive_scan(bins.tileOffsets.begin(), bins.tileOffsets.end(), bins.tileOffsets.begin());
+		bins.tilePoints.resize(bins.tileOffsets.back());
+		std::vector<uint32_t> cursor(bins.tileOffsets.begin(), bins.tileOffsets.end() - 1);
+		for (const auto& [key, i] : keys)
+			forEachTile(bins.splats[i], [&](const uint32_t tile) { bins.tilePoints[cursor[tile]++] = i; });
+
+		return bins;
+	}
+
+	// Blends the tile's points into a packet of pixels. Returns per-lane colors and the number of tile points visited.
+	inline static void RenderPacket(const PointCloud& pointCloud, const Bins& bins, const std::span<const uint32_t> points, const uint32_t x0, const uint32_t y, float4 (&color)[kLanes], uint32_t (&count)[kLanes], bool (&done)[kLanes]) {
+		float weight[kLanes];
+		bool  covered[kLanes];
+		for (uint32_t j = 0; j < points.size(); j++) {
+			const uint32_t i = points[j];
+			const SplatData sd = GetSplatData(bins.splats[i], pointCloud.colors[i]);
+			const bool any = EvalSplatWeights(sd, x0, y, weight, covered);
+
+			bool allDone = true;
+			for (uint32_t l = 0; l < kLanes; l++) {
+				if (done[l]) continue;
+				count[l] = j + 1;
+				if (any && covered[l]) {
+					// blend(color, evalSplat(...))
+					const float a = sd.color.w * weight[l];
+					color[l] = float4(float3(color[l]) + float3(sd.color) * a * color[l].w, color[l].w * (1 - a));
+				}
+				done[l] = color[l].w <= 1e-6f;
+				allDone &= done[l];
+			}
+			if (allDone) break;
+		}
+	}
+
+	inline Image Render(const PointCloud& pointCloud, const float4x4& view, const float4x4& projection, const uint2 extent) const {
+		const Camera camera{ view, projection, extent, pointSize };
+		const Bins bins = BinPoints(pointCloud, camera);
+
+		Image output{ extent, std::vector<float4>(size_t(extent.x) * extent.y) };
+		ParallelFor(bins.tileCount.x * bins.tileCount.y, [&](uint32_t, const uint32_t tile) {
+			const uint2 tileOrigin = uint2(tile % bins.tileCount.x, tile / bins.tileCount.x) * kTileSize;
+			const std::span<const uint32_t> points = std::span(bins.tilePoints).subspan(bins.tileOffsets[tile], bins.tileOffsets[tile + 1] - bins.tileOffsets[tile]);
+			for (uint32_t y = tileOrigin.y; y < std::min(tileOrigin.y + kTileSize, extent.y); y++) {
+				for (uint32_t x0 = tileOrigin.x; x0 < std::min(tileOrigin.x + kTileSize, extent.x); x0 += kLanes) {
+					float4   color[kLanes];
+					uint32_t count[kLanes] = {};
+					bool     done[kLanes];
+					for (uint32_t l = 0; l < kLanes; l++) {
+						color[l] = float4(0, 0, 0, 1);
+						done[l] = x0 + l >= extent.x;
+					}
+					RenderPacket(pointCloud, bins, points, x0, y, color, count, done);
+					for (uint32_t l = 0; l < kLanes && x0 + l < extent.x; l++)
+						output[uint2(x0 + l, y)] = color[l];
+				}
+			}
+		});
+		return output;
+	}
+
+	// computeLoss in Splat.slang
+	inline static float ComputeLoss(const float4 color, float4 gt) {
+		gt.w = 1 - gt.w;
+		const float4 error = color - gt;
+		return glm::dot(error * error, float4(1.f/4.f));
+	}
+
+	// Renders the view, compares it to `reference` (straight alpha, as loaded from the view images) and accumulates
+	// the loss gradients into `gradients`. Writes the rendered image to `output` if not null. Returns the total loss.
+	inline double RenderGradients(const PointCloud& pointCloud, const PointCloudGradients& gradients, const float4x4& view, const float4x4& projection, const Image& reference, Image* output = nullptr) const {
+		const uint2 extent = reference.extent;
+		const Camera camera{ view, projection, extent, pointSize };
+		const Bins bins = BinPoints(pointCloud, camera);
+		const uint32_t n = (uint32_t)pointCloud.vertices.size();
+
+		if (output) *output = Image{ extent, std::vector<float4>(size_t(extent.x) * extent.y) };
+
+		struct ThreadGradients {
+			std::vector<float3> splats;
+			std::vector<float4> colors;
+			double loss = 0;
+		};
+		const uint32_t numTiles = bins.tileCount.x * bins.tileCount.y;
+		std::vector<ThreadGradients> threadGradients(std::min(ThreadCount(), std::max(numTiles, 1u)));
+		for (ThreadGradients& g : threadGradients) {
+			g.splats.assign(n, float3(0));
+			g.colors.assign(n, float4(0));
+		}
+
+		ParallelFor(numTiles, [&](const uint32_t threadIndex, const uint32_t tile) {
+			ThreadGradients& g = threadGradients[threadIndex];
+			const uint2 tileOrigin = uint2(tile % bins.tileCount.x, tile / bins.tileCount.x) * kTileSize;
+			const std::span<const uint32_t> points = std::span(bins.tilePoints).subspan(bins.tileOffsets[tile], bins.tileOffsets[tile + 1] - bins.tileOffsets[tile]);
+
+			for (uint32_t y = tileOrigin.y; y < std::min(tileOrigin.y + kTileSize, extent.y); y++) {
+				for (uint32_t x0 = tileOrigin.x; x0 < std::min(tileOrigin.x + kTileSize, extent.x); x0 += kLanes) {
+					float4   color[kLanes];
+					uint32_t count[kLanes] = {};
+					bool     done[kLanes];
+					for (uint32_t l = 0; l < kLanes; l++) {
+						color[l] = float4(0, 0, 0, 1);
+						done[l] = x0 + l >= extent.x;
+					}
+					RenderPacket(pointCloud, bins, points, x0, y, color, count, done);
+
+					// loss and its gradient
+					float4 d_color[kLanes];
+					uint32_t maxCount = 0;
+					for (uint32_t l = 0; l < kLanes; l++) {
+						d_color[l] = float4(0);
+						if (x0 + l >= extent.x) continue;
+						const uint2 pixel(x0 + l, y);
+						float4 gt = reference[pixel];
+						g.loss += ComputeLoss(color[l], gt);
+						gt.w = 1 - gt.w;
+						d_color[l] = (color[l] - gt) * 0.5f;
+						maxCount = std::max(maxCount, count[l]);
+						if (output) (*output)[pixel] = color[l];
+					}
+
+					// walk the blended points back to front, restoring the color before each point with invBlend
+					float weight[kLanes];
+					bool  covered[kLanes];
+					for (int j = int(maxCount) - 1; j >= 0; j--) {
+						const uint32_t i = points[j];
+						const SplatData sd = GetSplatData(bins.splats[i], pointCloud.colors[i]);
+						if (!EvalSplatWeights(sd, x0, y, weight, covered))
+							continue;
+
+						float3 d_splat = float3(0);
+						float4 d_vertexColor = float4(0);
+						for (uint32_t l = 0; l < kLanes; l++) {
+							if (!covered[l] || uint32_t(j) >= count[l]) continue;
+
+							const float a = sd.color.w * weight[l];
+							const float3 fragRgb = float3(sd.color) * a;
+							const float  fragA   = 1 - a;
+
+							// invBlend
+							const float T = color[l].w / fragA;
+							const float4 inputColor = float4(float3(color[l]) - fragRgb * T, T);
+
+							// blend backward
+							const float3 d_fragRgb = float3(d_color[l]) * inputColor.w;
+							const float  d_fragA   = d_color[l].w * inputColor.w;
+							d_color[l] = float4(float3(d_color[l]), glm::dot(float3(d_color[l]), fragRgb) + d_color[l].w * fragA);
+							color[l] = inputColor;
+
+							// evalSplat backward
+							const float d_a = glm::dot(d_fragRgb, float3(sd.color)) - d_fragA;
+							d_vertexColor += float4(d_fragRgb * a, d_a * weight[l]);
+							const float2 d = (float2(float(x0 + l), float(y)) + 0.5f - sd.center) / sd.s;
+							const float2 d_d = d * (2 * d_a * sd.color.w * weight[l] * -5.f);
+							d_splat += float3(-d_d / sd.s, -glm::dot(d_d, d) / sd.s);
+						}
+						g.splats[i] += d_splat;
+						g.colors[i] += d_vertexColor;
+					}
+				}
+			}
+		});
+
+		// reduce in thread order, then backpropagate through the projection once per point
+		double loss = 0;
+		for (const ThreadGradients& g : threadGradients) loss += g.loss;
+		ParallelFor((n + 4095) / 4096, [&](uint32_t, const uint32_t block) {
+			for (uint32_t i = block*4096; i < std::min(n, (block + 1)*4096); i++) {
+				float3 d_splat = float3(0);
+				float4 d_color = float4(0);
+				for (const ThreadGradients& g : threadGradients) {
+					d_splat += g.splats[i];
+					d_color += g.colors[i];
+				}
+				if (d_splat != float3(0))
+					gradients.vertices[i] += ProjectPointBwd(camera, pointCloud.vertices[i], d_splat);
+				gradients.colors[i] += d_color;
+			}
+		});
+
+		return loss;
+	}
+};
+
+}
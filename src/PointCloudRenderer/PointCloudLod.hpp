@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <queue>
+
+#include <Rose/Core/CommandContext.hpp>
+#include <Rose/Core/PipelineCache.hpp>
+
+#include "Scene/PointCloudScene.hpp"
+#include "GpuProfiler.hpp"
+#include "ShaderPrecompiler.hpp"
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Draws a point cloud through a cut of its LodHierarchy (see Lod.cs.slang).
+// Node statistics are refreshed from the point cloud whenever it is marked dirty. Every frame, the nodes are
+// tested against a pixel error budget and the selected proxy and leaf points are appended into a point cloud,
+// which the regular Sort and Render paths then draw. The output is sized from the selected counts of previous
+// frames; unused entries hold NaN positions, which sorting culls.
+// With `adaptive` set, the pixel error is adjusted every frame to keep the viewport's GPU time within frameBudget.
+struct PointCloudLod {
+	PipelineCache updateNodes = PipelineCache(FindShaderPath("Lod.cs.slang"), "updateNodes");
+	PipelineCache selectNodes = PipelineCache(FindShaderPath("Lod.cs.slang"), "selectNodes");
+
+	bool  enabled  = true;
+	float pixelError    = 1.f;  // pixels a node may exceed a single point's footprint by, and still be drawn as one point
+	bool  adaptive      = true;
+	float frameBudget   = 8.f;  // milliseconds
+	float maxPixelError = 64.f;
+	bool  dirty = true; // node statistics must be recomputed, e.g. after an optimizer step
+
+	BufferRange<float4> nodeStats;
+
+	uint32_t selectedEstimate = 0;
+	std::queue<std::pair<BufferRange<uint32_t>, uint64_t>> selectedCountQueue;
+	std::vector<BufferRange<uint32_t>> freeSelectedCountCpu;
+
+	inline void Reset() {
+		nodeStats = {};
+		selectedEstimate = 0;
+		selectedCountQueue = {};
+		dirty = true;
+	}
+
+	inline void Precompile(ShaderPrecompiler& precompiler) {
+		precompiler.Add(updateNodes);
+		precompiler.Add(selectNodes);
+	}
+
+	// The hierarchy only matches the point cloud until densification changes the point count
+	inline bool IsUsable(const LodHierarchy& lod, const PointCloud& pointCloud) const {
+		return enabled && lod && lod.pointCount == pointCloud.size();
+	}
+
+	inline void DrawGui(const LodHierarchy& lod, const PointCloud& pointCloud) {
+		ImGui::Checkbox("Enable", &enabled);
+		if (!lod) {
+			ImGui::TextUnformatted("No hierarchy");
+			return;
+		}
+		ImGui::Text("%u nodes, %u levels", lod.NodeCount(), lod.LevelCount());
+		if (lod.pointCount != pointCloud.size())
+			ImGui::TextUnformatted("Out of date, the point count changed");
+		ImGui::Checkbox("Fixed frame time", &adaptive);
+		if (adaptive)
+			ImGui::DragFloat("Frame budget (ms)", &frameBudget, 0.1f, 0.5f, 100.f);
+		ImGui::DragFloat("Pixel error", &pixelError, 0.05f, 0.f, maxPixelError);
+		if (selectedEstimate > 0) {
+			const auto&[number,unit] = FormatNumber(selectedEstimate);
+			ImGui::Text("Selected points: ~%.2f%s", number, unit);
+		}
+	}
+
+	// Multiplicative step towards frameBudget, given the last measured render time
+	inline void AdaptPixelError(const double renderMilliseconds) {
+		if (!adaptive || renderMilliseconds <= 0) return;
+		if (renderMilliseconds > frameBudget)
+			pixelError = std::min(std::max(pixelError, 0.25f) * 1.05f, maxPixelError);
+		else if (renderMilliseconds < frameBudget * 0.8f)
+			pixelError = std::max(pixelError / 1.05f - 0.01f, 0.f);
+	}
+
+	inline void UpdateNodes(CommandContext& context, const LodHierarchy& lod, const PointCloud& pointCloud) {
+		GpuProfiler::PushRegion(context, "Update LOD nodes");
+
+		if (!nodeStats || nodeStats.size() != lod.NodeCount() * 4)
+			nodeStats = Buffer::Create(context.GetDevice(), lod.NodeCount() * 4 * sizeof(float4), vk::BufferUsageFlagBits::eStorageBuffer);
+
+		ShaderParameter params = {};
+		params["pointCloud"]   = pointCloud.GetShaderParameter();
+		params["nodes"]        = (BufferParameter)lod.nodes;
+		params["pointIndices"] = (BufferParameter)lod.pointIndices;
+		params["nodeStats"]    = (BufferParameter)nodeStats;
+		// deepest level first, so children are aggregated before their parents
+		for (uint32_t level = lod.LevelCount(); level-- > 0;) {
+			params["levelBegin"] = lod.levelOffsets[level];
+			params["levelEnd"]   = lod.levelOffsets[level + 1];
+			updateNodes(context, uint3(lod.levelOffsets[level + 1] - lod.levelOffsets[level], 1, 1), params);
+		}
+		dirty = false;
+
+		GpuProfiler::PopRegion(context);
+	}
+
+	// Selects the points to draw for a view. The result only has data buffers, and is only valid for rendering.
+	inline PointCloud Select(CommandContext& context, const LodHierarchy& lod, const PointCloud& pointCloud, const Transform& sceneToCamera, const Transform& projection, const uint2 renderExtent, const float pointSize) {
+		while (!selectedCountQueue.empty() && ContextTimeline::CurrentValue(context) >= selectedCountQueue.front().second) {
+			const uint32_t selectedCount = selectedCountQueue.front().first[0];
+			// grow immediately, shrink slowly
+			selectedEstimate = std::max(selectedCount, selectedEstimate - (selectedEstimate - std::min(selectedCount, selectedEstimate))/8);
+			freeSelectedCountCpu.emplace_back(selectedCountQueue.front().first);
+			selectedCountQueue.pop();
+		}
+		// at most every point, plus a proxy per node
+		const uint32_t capacity = std::min(lod.pointCount + lod.NodeCount(), std::max(selectedEstimate + selectedEstimate/4, 65536u));
+
+		if (dirty || !nodeStats) UpdateNodes(context, lod, pointCloud);
+
+		GpuProfiler::PushRegion(context, "Select LOD");
+
+		const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst;
+		const BufferRange<std::byte> vertices = context.GetTransientBuffer<std::byte>(capacity * sizeof(float3), usage);
+		const BufferRange<std::byte> colors   = context.GetTransientBuffer<std::byte>(capacity * sizeof(float4), usage);
+		const BufferRange<uint32_t>  count    = context.GetTransientBuffer<uint32_t>(1, usage);
+		context.Fill(vertices.cast<uint32_t>(), 0x7FC00000u); // NaN
+		context.Fill(count, 0u);
+
+		ShaderParameter params = {};
+		params["pointCloud"]     = pointCloud.GetShaderParameter();
+		params["nodes"]          = (BufferParameter)lod.nodes;
+		params["pointIndices"]   = (BufferParameter)lod.pointIndices;
+		params["nodeStats"]      = (BufferParameter)nodeStats;
+		params["view"]           = sceneToCamera.transform;
+		params["projection"]     = projection.transform;
+		params["outputExtent"]   = renderExtent;
+		params["pointSize"]      = pointSize;
+		params["zSign"]          = (int32_t)(projection.transform[2][2] > 0 ? 1 : -1);
+		params["pixelError"]     = pixelError;
+		params["nodeCount"]      = lod.NodeCount();
+		params["outputCapacity"] = capacity;
+		params["outputVertices"] = (BufferParameter)vertices;
+		params["outputColors"]   = (BufferParameter)colors;
+		params["outputCount"]    = (BufferParameter)count;
+		selectNodes(context, uint3(lod.NodeCount(), 1, 1), params);
+
+		BufferRange<uint32_t> countCpu = GetReadbackBuffer(freeSelectedCountCpu, context.GetDevice());
+		context.Copy(count, countCpu);
+		selectedCountQueue.push({ countCpu, ContextTimeline::NextSignal(context) });
+
+		GpuProfiler::PopRegion(context);
+
+		// forward rendering only reads the data buffers
+		return PointCloud{
+			.vertices     = BufferGradient<3>{ .data = vertices, .gradients = vertices, .moments1 = vertices, .moments2 = vertices, .count = capacity },
+			.vertexColors = BufferGradient<4>{ .data = colors,   .gradients = colors,   .moments1 = colors,   .moments2 = colors,   .count = capacity } };
+	}
+};
+
+}
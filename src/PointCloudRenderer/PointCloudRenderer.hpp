@@ -1,74 +1,145 @@
 #pragma once
 
+#include <bit>
+#include <queue>
+
 #include <Rose/Core/CommandContext.hpp>
 #include <Rose/Core/PipelineCache.hpp>
 #include <Rose/Render/ViewportCamera.hpp>
 
 #include "Scene/PointCloudScene.hpp"
+#include "TemporalSort.hpp"
+#include "PrefixSum/PrefixSum.hpp"
+#include "KeySort/KeySort.hpp"
+#include "GpuProfiler.hpp"
+#include "ShaderPrecompiler.hpp"
 
 using namespace RoseEngine;
 
 namespace vkgsplat {
 
+// Camera of one view rendered by the tiled renderer. Must match TiledView in TiledRenderer.cs.slang.
+struct TiledView {
+	float4   view[4]; // columns
+	float4   projection[4];
+	uint2    extent;
+	int32_t  zSign;
+	uint32_t pad;
+
+	inline static TiledView Create(const Transform& sceneToCamera, const Transform& projection, const uint2 extent) {
+		TiledView v = { .extent = extent, .zSign = projection.transform[2][2] > 0 ? 1 : -1, .pad = 0 };
+		for (uint32_t i = 0; i < 4; i++) {
+			v.view[i]       = sceneToCamera.transform[i];
+			v.projection[i] = projection.transform[i];
+		}
+		return v;
+	}
+};
+static_assert(sizeof(TiledView) == 144);
+
 struct PointCloudRenderer {
 	PipelineCache createSortPairs = PipelineCache(FindShaderPath("CreateSortPairs.cs.slang"));
+	PipelineCache createDrawArgs  = PipelineCache(FindShaderPath("CreateSortPairs.cs.slang"), "writeDrawArgs");
+	PipelineCache reduceDepthRange = PipelineCache(FindShaderPath("CreateSortPairs.cs.slang"), "reduceDepthRange");
 	PipelineCache rasterPoints = PipelineCache({
 		{ FindShaderPath("PointCloudRenderer.3d.slang"), "meshmain" },
 		{ FindShaderPath("PointCloudRenderer.3d.slang"), "fsmain" }
 	});
 	PipelineCache computeRender    = PipelineCache(FindShaderPath("PointCloudRenderer.cs.slang"), "render");
 	PipelineCache computeRenderBwd = PipelineCache(FindShaderPath("PointCloudRenderer.cs.slang"), "__bwd_render");
+	PipelineCache binTilePoints      = PipelineCache(FindShaderPath("TiledRenderer.cs.slang"), "binPoints");
+	PipelineCache identifyTileRanges = PipelineCache(FindShaderPath("TiledRenderer.cs.slang"), "identifyTileRanges");
+	PipelineCache renderTiles        = PipelineCache(FindShaderPath("TiledRenderer.cs.slang"), "renderTiles");
+	PipelineCache renderTilesBwd     = PipelineCache(FindShaderPath("TiledRenderer.cs.slang"), "renderTilesBwd");
+	PipelineCache countTiles         = PipelineCache(FindShaderPath("TiledRenderer.cs.slang"), "countTiles");
+	PipelineCache reduceGradients    = PipelineCache(FindShaderPath("TiledRenderer.cs.slang"), "reduceGradients");
+	PipelineCache reduceLoss         = PipelineCache(FindShaderPath("TiledRenderer.cs.slang"), "reduceLoss");
+	PipelineCache estimateFootprint  = PipelineCache(FindShaderPath("TiledRenderer.cs.slang"), "estimateFootprint");
 	float pointSize = 0.05f;
 	float percentToDraw = 1.0f;
+
+	// Rasterizer of Render. Auto uses the tiled compute renderer when most splats are only a few pixels wide,
+	// where the quads of the mesh shader path mostly cost fixed-function overhead, and mesh shaders otherwise.
+	enum class RasterMode { eAuto, eMeshShader, eCompute };
+	RasterMode rasterMode = RasterMode::eAuto;
+	bool  meshShaders = true; // VK_EXT_mesh_shader is enabled. Without it, Render always uses the compute rasterizer.
+	float computeRasterPixels = 3.f; // auto: use the compute rasterizer below this median splat diameter
+	bool  adaptiveSortKeys = true; // quantize depths over the visible depth range, and sort only the bits needed
+	bool  tiledGradients = true;  // use the tiled compute renderer in RenderGradients
+	bool  gradientPartials = true;        // write per-tile partial gradients and reduce them per point, instead of global atomics
+	bool  deterministicGradients = false; // bit-reproducible tiled gradients and loss (implies gradientPartials)
+
+	static constexpr uint32_t kTileSize = 16;
+	static constexpr uint32_t kSmallSplatTileSize = 8; // compute rasterizer tiles when the median splat diameter is below half of it
+	static constexpr uint32_t kFootprintSamples = 4096;
+	static constexpr uint32_t kSortKeyExtraBits = 6; // adaptive sort keys: depth buckets per visible point, log2
+	// tile keys are written into a buffer sized from the key count of previous frames.
+	// Frames whose keys did not fit are discarded by the tiled shaders (see TiledRenderer.cs.slang).
+	struct TileKeyCountReadback {
+		BufferRange<uint32_t> keyCount;
+		uint64_t timelineValue;
+		uint32_t capacity;
+	};
+	uint32_t tileKeyCapacity = 0;
+	uint32_t tileKeyOverflows = 0; // discarded frames
+	std::queue<TileKeyCountReadback> tileKeyCountQueue;
+	std::vector<BufferRange<uint32_t>> freeTileKeyCountCpu;
     
+	// fraction of sampled splats below computeRasterPixels and below kSmallSplatTileSize/2, from previous frames
+	float2 footprintFractions = float2(0);
+	bool   autoCompute    = false;
+	bool   smallSplatTiles = true;
+	std::queue<std::pair<BufferRange<uint32_t>, uint64_t>> footprintQueue;
+	std::vector<BufferRange<uint32_t>> freeFootprintCpu;
+
 	RadixSort radixSort;
+	KeySort   keySort;
+	PrefixSum prefixSum;
+	TemporalSort temporalSort;
+
+    inline bool UseComputeRaster() const {
+        if (!meshShaders || rasterMode == RasterMode::eCompute) return true;
+        return rasterMode == RasterMode::eAuto && autoCompute;
+    }
 
     inline void DrawGui(CommandContext& context) {
         ImGui::DragFloat("Point size", &pointSize, .01f, 0.f, 4000.f);
         ImGui::SliderFloat("Amount to draw", &percentToDraw, 0.f, 1.f);
-    }
-
-    inline BufferRange<uint2> Sort(CommandContext& context, const PointCloud& pointCloud, const Transform& sceneToCamera, const Transform& projection) {
-        const uint32_t vertexCount = (uint32_t)pointCloud.size();
-        BufferRange<uint2> sortPairs = context.GetTransientBuffer<uint2>(vertexCount, vk::BufferUsageFlagBits::eStorageBuffer);
-    
-        context.PushDebugLabel("Sort points");
-        ShaderParameter params = {};
-        params["sortPairs"] = (BufferParameter)sortPairs;
-        params["vertices"]  = (BufferParameter)pointCloud.vertices.data;
-        params["view"] = sceneToCamera.transform;
-        params["vertexCount"] = vertexCount;
-        params["zSign"] = (int32_t)(projection.transform[2][2] > 0 ? 1 : -1);
-        createSortPairs(context, uint3(vertexCount,1,1), params);
-        radixSort(context, sortPairs);
-        context.PopDebugLabel();
-
-        return sortPairs;
-    }
-    
-	inline void Render(
-        CommandContext&   context,
-        const ImageView&  renderTarget,
-        const PointCloud& pointCloud,
-        const Transform&  sceneToCamera,
-        const Transform&  projection,
-        BufferRange<uint2> sortPairs = {}) {
-        const uint32_t vertexCount = (uint32_t)pointCloud.size();
-		if (vertexCount == 0)
-        {
-            context.ClearColor(renderTarget, vk::ClearColorValue{std::array<float,4>{ 0, 0, 0, 1 }});
-            return;
+        if (meshShaders) {
+            static const char* modes[] = { "Auto", "Mesh shader", "Compute" };
+            ImGui::Combo("Rasterizer", (int*)&rasterMode, modes, 3);
+            if (rasterMode == RasterMode::eAuto)
+                ImGui::DragFloat("Compute below (px)", &computeRasterPixels, 0.1f, 0.f, 64.f);
+        } else
+            ImGui::TextUnformatted("Rasterizer: compute (no mesh shaders)");
+        if (UseComputeRaster())
+            ImGui::Text("Compute tiles: %ux%u, %.0f%% of splats small", smallSplatTiles ? kSmallSplatTileSize : kTileSize, smallSplatTiles ? kSmallSplatTileSize : kTileSize, footprintFractions.y * 100);
+        ImGui::Checkbox("Tiled gradients", &tiledGradients);
+        if (tiledGradients) {
+            ImGui::Checkbox("Partial gradients", &gradientPartials);
+            ImGui::Checkbox("Deterministic gradients", &deterministicGradients);
         }
+        if (!UseComputeRaster()) {
+            ImGui::Checkbox("Adaptive sort keys", &adaptiveSortKeys);
+            if (adaptiveSortKeys && visibleCountEstimate > 0)
+                ImGui::Text("%u bit keys", GetSortKeyBits(visibleCountEstimate));
+            temporalSort.DrawGui();
+        }
+        if (visibleCountEstimate > 0) {
+            const auto&[number,unit] = FormatNumber(visibleCountEstimate);
+            ImGui::Text("Visible points: ~%.2f%s", number, unit);
+        }
+        if (tileKeyCapacity > 0) {
+            const auto&[number,unit] = FormatNumber(tileKeyCapacity);
+            ImGui::Text("Tile key capacity: %.2f%s", number, unit);
+            if (tileKeyOverflows > 0)
+                ImGui::Text("Frames discarded for tile key space: %u", tileKeyOverflows);
+        }
+    }
 
-        if (!sortPairs) sortPairs = Sort(context, pointCloud, sceneToCamera, projection);
-        
-        const uint2 renderExtent = renderTarget.Extent();
-
-        // prepare draw pipeline
-
-        ShaderDefines defines;
-        
-        GraphicsPipelineInfo pipelineInfo {
+    // Fixed-function state of rasterPoints: points are blended front to back into the render target
+    inline static GraphicsPipelineInfo GetRasterPipelineInfo(const vk::Format colorFormat) {
+        return GraphicsPipelineInfo {
             .vertexInputState = {},
             .inputAssemblyState = vk::PipelineInputAssemblyStateCreateInfo{
                 .topology = vk::PrimitiveTopology::eTriangleList },
@@ -100,8 +171,356 @@ struct PointCloudRenderer {
                     .colorWriteMask      = vk::ColorComponentFlags{vk::FlagTraits<vk::ColorComponentFlagBits>::allFlags} } } },
             .dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor },
             .dynamicRenderingState = DynamicRenderingState{
-                .colorFormats = { renderTarget.GetImage()->Info().format } } };
-        Pipeline& drawPipeline = *rasterPoints.get(context.GetDevice(), defines, pipelineInfo).get();
+                .colorFormats = { colorFormat } } };
+    }
+
+    // Registers the variants this renderer dispatches, including its sorts. Render targets have colorFormat.
+    inline void Precompile(ShaderPrecompiler& precompiler, const vk::Format colorFormat) {
+        precompiler.Add(createSortPairs);
+        precompiler.Add(createDrawArgs);
+        precompiler.Add(reduceDepthRange);
+        keySort.Precompile(precompiler);
+        if (meshShaders)
+            precompiler.Add([this, colorFormat](Device& device) { rasterPoints.get(device, ShaderDefines{}, GetRasterPipelineInfo(colorFormat)); });
+        precompiler.Add(computeRender);
+        for (const char* loss : { "0", "1" })
+            precompiler.Add(computeRenderBwd, { { "OUTPUT_LOSS", loss } });
+
+        precompiler.Add(countTiles);
+        for (const char* deterministic : { "0", "1" })
+            precompiler.Add(binTilePoints, { { "DETERMINISTIC_BINNING", deterministic } });
+        precompiler.Add(identifyTileRanges);
+        precompiler.Add(renderTiles);
+        precompiler.Add(estimateFootprint);
+        precompiler.Add(binTilePoints, TileDefines(kSmallSplatTileSize, { { "DETERMINISTIC_BINNING", "0" } }));
+        precompiler.Add(renderTiles,   TileDefines(kSmallSplatTileSize));
+        for (const char* loss : { "0", "1" }) {
+            // deterministic gradients imply partials
+            for (const auto&[partials, deterministic] : { std::pair{ "0", "0" }, std::pair{ "1", "0" }, std::pair{ "1", "1" } }) {
+                const ShaderDefines defines = {
+                    { "OUTPUT_LOSS", loss },
+                    { "GRADIENT_PARTIALS", partials },
+                    { "DETERMINISTIC_BINNING", deterministic } };
+                precompiler.Add(renderTilesBwd, defines);
+                if (partials[0] == '1')
+                    precompiler.Add(reduceGradients, defines);
+                if (loss[0] == '1' && deterministic[0] == '1')
+                    precompiler.Add(reduceLoss, defines);
+            }
+        }
+
+        prefixSum.Precompile(precompiler);
+        temporalSort.Precompile(precompiler);
+    }
+
+    // points drawn by each mesh shader workgroup in PointCloudRenderer.3d.slang (GROUP_SIZE/4)
+    static constexpr uint32_t kPointsPerMeshGroup = 8;
+
+    // visible-point count estimate (0 if unknown), used to only radix sort the compacted range
+    uint32_t visibleCountEstimate = 0;
+    std::queue<std::pair<BufferRange<uint32_t>, uint64_t>> visibleCountQueue;
+    std::vector<BufferRange<uint32_t>> freeVisibleCountCpu;
+
+    // Bits of the quantized depth keys, from the number of points to sort. A multiple of the 8 bit radix.
+    inline static uint32_t GetSortKeyBits(const uint32_t sortCount) {
+        return std::clamp<uint32_t>((std::bit_width(sortCount) + kSortKeyExtraBits + 7) / 8 * 8, 16, 24);
+    }
+
+    // Culls points against the view frustum, compacts the visible ones and sorts them by depth.
+    // With adaptiveSortKeys, depths are quantized over the visible depth range, so 2 or 3 radix passes
+    // replace the 4 passes of a full float key. Points closer in depth than a quantization step may be
+    // drawn in either order. drawFraction of the nearest visible points are drawn: percentToDraw in the viewport,
+    // and all of them when training.
+    inline SortedPoints Sort(CommandContext& context, const PointCloud& pointCloud, const Transform& sceneToCamera, const Transform& projection, const uint2 renderExtent, const float drawFraction = 1.f) {
+        const uint32_t vertexCount = (uint32_t)pointCloud.size();
+
+        while (!visibleCountQueue.empty() && ContextTimeline::CurrentValue(context) >= visibleCountQueue.front().second) {
+            const uint32_t visibleCount = visibleCountQueue.front().first[0];
+            // grow immediately, shrink slowly since different views are sorted in the same frame
+            visibleCountEstimate = std::max(visibleCount, visibleCountEstimate - (visibleCountEstimate - std::min(visibleCount, visibleCountEstimate))/8);
+            freeVisibleCountCpu.emplace_back(visibleCountQueue.front().first);
+            visibleCountQueue.pop();
+        }
+        // points past sortCount are compacted but not sorted, which only happens briefly after the visible set grows.
+        // They are not drawn, since they would blend out of order.
+        uint32_t sortCount = vertexCount;
+        if (visibleCountEstimate > 0) sortCount = std::min(vertexCount, visibleCountEstimate + visibleCountEstimate/4 + 1024);
+
+        SortedPoints sorted = {
+            .sortPairs  = context.GetTransientBuffer<uint2>(vertexCount, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst),
+            .sortCounts = context.GetTransientBuffer<uint32_t>(5, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eIndirectBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst) };
+    
+        GpuProfiler::PushRegion(context, "Sort points");
+
+        // unused entries in the sorted range sort to the end
+        context.Fill(sorted.sortPairs.slice(0, sortCount).cast<uint32_t>(), UINT32_MAX);
+        context.Fill(sorted.sortCounts, 0u);
+
+        const uint32_t keyBits = adaptiveSortKeys ? GetSortKeyBits(sortCount) : 0;
+
+        ShaderParameter params = {};
+        params["sortPairs"]  = (BufferParameter)sorted.sortPairs;
+        params["sortCounts"] = (BufferParameter)sorted.sortCounts;
+        params["vertices"]   = (BufferParameter)pointCloud.vertices.FullPrecisionData();
+        params["view"] = sceneToCamera.transform;
+        params["projection"] = projection.transform;
+        params["outputExtent"] = renderExtent;
+        params["pointSize"] = pointSize;
+        params["vertexCount"] = vertexCount;
+        params["zSign"] = (int32_t)(projection.transform[2][2] > 0 ? 1 : -1);
+        params["drawFraction"] = drawFraction;
+        params["pointsPerMeshGroup"] = kPointsPerMeshGroup;
+        params["sortedCount"] = sortCount;
+        params["keyBits"] = keyBits;
+        if (keyBits > 0) {
+            const BufferRange<uint32_t> depthRange = context.GetTransientBuffer<uint32_t>(2, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst);
+            context.Fill(depthRange.slice(0, 1), UINT32_MAX);
+            context.Fill(depthRange.slice(1, 1), 0u);
+            params["depthRange"] = (BufferParameter)depthRange;
+            reduceDepthRange(context, uint3(vertexCount,1,1), params);
+        }
+        createSortPairs(context, uint3(vertexCount,1,1), params);
+        createDrawArgs(context, uint3(1,1,1), params);
+        if (keyBits > 0)
+            keySort(context, sorted.sortPairs.slice(0, sortCount), keyBits);
+        else
+            radixSort(context, sorted.sortPairs.slice(0, sortCount));
+
+        BufferRange<uint32_t> visibleCountCpu = GetReadbackBuffer(freeVisibleCountCpu, context.GetDevice());
+        context.Copy(sorted.sortCounts.slice(0, 1), visibleCountCpu);
+        visibleCountQueue.push({ visibleCountCpu, ContextTimeline::NextSignal(context) });
+
+        GpuProfiler::PopRegion(context);
+
+        return sorted;
+    }
+
+    // Sorts for an interactive view, reusing and repairing the previous frame's order when the camera moved little
+    inline SortedPoints SortTemporal(CommandContext& context, const PointCloud& pointCloud, const Transform& sceneToCamera, const Transform& projection, const uint2 renderExtent) {
+        if (pointCloud.size() == 0) return {};
+        return temporalSort(context, pointCloud, sceneToCamera, projection, renderExtent, pointSize, percentToDraw, kPointsPerMeshGroup);
+    }
+
+    struct TileBins {
+        BufferRange<float4>   splats;
+        BufferRange<uint2>    tileKeys;
+        BufferRange<uint2>    tileRanges;
+        BufferRange<uint32_t> tileKeyCount;
+        BufferRange<uint32_t> keyVertexIds;
+        BufferRange<uint2>    pointKeyRanges;
+        BufferRange<uint32_t> pointKeyOffsets;
+        BufferRange<TiledView> views;
+        uint2    tileCount;
+        uint32_t tileBits;
+        uint32_t slotHeight;
+
+        inline void SetShaderParameters(ShaderParameter& params) const {
+            params["splats"]          = (BufferParameter)splats;
+            params["tileKeys"]        = (BufferParameter)tileKeys;
+            params["tileRanges"]      = (BufferParameter)tileRanges;
+            params["tileKeyCount"]    = (BufferParameter)tileKeyCount;
+            params["keyVertexIds"]    = (BufferParameter)keyVertexIds;
+            params["pointKeyRanges"]  = (BufferParameter)pointKeyRanges;
+            if (pointKeyOffsets) params["pointKeyOffsets"] = (BufferParameter)pointKeyOffsets;
+            params["tileCount"]       = tileCount;
+            params["tileBits"]        = tileBits;
+            params["tileKeyCapacity"] = (uint32_t)tileKeys.size();
+            params["views"]           = (BufferParameter)views;
+            params["viewCount"]       = (uint32_t)views.size();
+            params["slotHeight"]      = slotHeight;
+        }
+    };
+
+    // Height of the rows each view occupies in a batch image, a whole number of tiles
+    inline static uint32_t GetSlotHeight(const uint32_t height, const uint32_t tileSize = kTileSize) { return (height + tileSize - 1) / tileSize * tileSize; }
+
+    // TILE_SIZE is only defined for other tile sizes than kTileSize, so the default variants are shared
+    inline static ShaderDefines TileDefines(const uint32_t tileSize, ShaderDefines defines = {}) {
+        if (tileSize != kTileSize) defines["TILE_SIZE"] = std::to_string(tileSize);
+        return defines;
+    }
+
+    // Projects all points and sorts (tile, depth) keys for every screen tile each splat overlaps.
+    // Each view is binned into its own slot of slotHeight rows, stacked vertically, so all views share one sort.
+    // If deterministic, keys are emitted at prefix-summed offsets so their order does not depend on scheduling.
+    inline TileBins BinTiles(CommandContext& context, const PointCloud& pointCloud, const std::span<const TiledView> views, const uint32_t slotHeight, const bool deterministic = false, const uint32_t tileSize = kTileSize) {
+        const uint32_t vertexCount = (uint32_t)pointCloud.size();
+        const uint32_t viewCount   = (uint32_t)views.size();
+        const uint32_t pointCount  = vertexCount * viewCount; // per-point entries of every view
+
+        // resize the key buffer from the key counts of previous frames
+        while (!tileKeyCountQueue.empty() && ContextTimeline::CurrentValue(context) >= tileKeyCountQueue.front().timelineValue) {
+            const TileKeyCountReadback& r = tileKeyCountQueue.front();
+            const uint32_t keyCount = r.keyCount[0];
+            // the frame was discarded, so leave more headroom than for gradual growth
+            if (keyCount > r.capacity) tileKeyOverflows++;
+            if (keyCount > tileKeyCapacity || keyCount < tileKeyCapacity/4)
+                tileKeyCapacity = std::max(keyCount > r.capacity ? 2*keyCount : keyCount + keyCount/2, 1u << 16);
+            freeTileKeyCountCpu.emplace_back(r.keyCount);
+            tileKeyCountQueue.pop();
+        }
+        if (tileKeyCapacity == 0) tileKeyCapacity = std::max(2*pointCount, 1u << 16);
+
+        uint32_t width = 1;
+        for (const TiledView& v : views) width = std::max(width, v.extent.x);
+
+        TileBins bins = {};
+        bins.slotHeight = slotHeight;
+        bins.tileCount  = uint2((width + tileSize - 1) / tileSize, viewCount * slotHeight / tileSize);
+        // leave the all-ones tile id unused so UINT32_MAX keys mark unused entries
+        bins.tileBits  = std::max<uint32_t>(std::bit_width(bins.tileCount.x * bins.tileCount.y), 1);
+
+        bins.views        = context.UploadData(views, vk::BufferUsageFlagBits::eStorageBuffer);
+        bins.splats       = context.GetTransientBuffer<float4>(pointCount, vk::BufferUsageFlagBits::eStorageBuffer);
+        bins.tileKeys     = context.GetTransientBuffer<uint2>(tileKeyCapacity, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst);
+        bins.tileRanges   = context.GetTransientBuffer<uint2>(bins.tileCount.x * bins.tileCount.y, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst);
+        bins.keyVertexIds   = context.GetTransientBuffer<uint32_t>(tileKeyCapacity, vk::BufferUsageFlagBits::eStorageBuffer);
+        bins.pointKeyRanges = context.GetTransientBuffer<uint2>(pointCount, vk::BufferUsageFlagBits::eStorageBuffer);
+        if (deterministic) {
+            // key counts of every point and a trailing 0, so the last offset after the scan is the total key count
+            bins.pointKeyOffsets = context.GetTransientBuffer<uint32_t>(pointCount + 1, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
+            bins.tileKeyCount    = bins.pointKeyOffsets.slice(pointCount, 1);
+        } else
+            bins.tileKeyCount = context.GetTransientBuffer<uint32_t>(1, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
+
+        GpuProfiler::PushRegion(context, "Bin points");
+
+        context.Fill(bins.tileKeys.cast<uint32_t>(), UINT32_MAX);
+        context.Fill(bins.tileRanges.cast<uint32_t>(), 0u);
+        context.Fill(bins.tileKeyCount, 0u);
+
+        ShaderParameter params = {};
+        params["pointCloud"]   = pointCloud.GetShaderParameter();
+        params["pointSize"]    = pointSize;
+        bins.SetShaderParameters(params);
+        const ShaderDefines defines = TileDefines(tileSize, { { "DETERMINISTIC_BINNING", deterministic ? "1" : "0" } });
+        if (deterministic) {
+            countTiles(context, uint3(vertexCount, viewCount, 1), params, TileDefines(tileSize));
+            prefixSum(context, bins.pointKeyOffsets);
+        }
+        binTilePoints(context, uint3(vertexCount, viewCount, 1), params, defines);
+
+        GpuProfiler::PushRegion(context, "Sort tile keys");
+        radixSort(context, bins.tileKeys);
+        GpuProfiler::PopRegion(context);
+
+        identifyTileRanges(context, uint3(tileKeyCapacity, 1, 1), params);
+
+        // read back the key count to size the next frame's buffer
+        BufferRange<uint32_t> keyCountCpu = GetReadbackBuffer(freeTileKeyCountCpu, context.GetDevice());
+        context.Copy(bins.tileKeyCount, keyCountCpu);
+        tileKeyCountQueue.push({ .keyCount = keyCountCpu, .timelineValue = ContextTimeline::NextSignal(context), .capacity = tileKeyCapacity });
+
+        GpuProfiler::PopRegion(context);
+
+        return bins;
+    }
+
+    inline ShaderParameter GetTiledShaderParameters(const PointCloud& pointCloud, const TileBins& bins, const ImageView& renderTarget, const ImageView& pixelVertexCounts) {
+        ShaderParameter params = {};
+        params["pointCloud"]        = pointCloud.GetShaderParameter();
+        params["outputColor"]       = ImageParameter{.image = renderTarget,      .imageLayout = vk::ImageLayout::eGeneral};
+        params["pixelVertexCounts"] = ImageParameter{.image = pixelVertexCounts, .imageLayout = vk::ImageLayout::eGeneral};
+        params["pointSize"]         = pointSize;
+        params["drawFraction"]      = 1.f;
+        bins.SetShaderParameters(params);
+        return params;
+    }
+
+    inline ImageView CreatePixelVertexCounts(CommandContext& context, const uint2 renderExtent) {
+        return ImageView::Create(context.GetTransientImage(
+            uint3(renderExtent, 1),
+            vk::Format::eR32Uint,
+            vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage));
+    }
+
+    // Renders with the tiled compute renderer. Produces the same images as the per-pixel compute path,
+    // up to the order of points whose depths differ by less than the key precision.
+    // percentToDraw keeps the nearest points of each tile. If the tile keys overflow, renderTarget keeps its
+    // previous contents.
+    inline void RenderTiled(
+        CommandContext&   context,
+        const ImageView&  renderTarget,
+        const PointCloud& pointCloud,
+        const Transform&  sceneToCamera,
+        const Transform&  projection,
+        const uint32_t    tileSize = kTileSize) {
+        const uint2 renderExtent = renderTarget.Extent();
+        const TiledView view = TiledView::Create(sceneToCamera, projection, renderExtent);
+        const TileBins bins = BinTiles(context, pointCloud, std::span(&view, 1), GetSlotHeight(renderExtent.y, tileSize), false, tileSize);
+        ShaderParameter params = GetTiledShaderParameters(pointCloud, bins, renderTarget, CreatePixelVertexCounts(context, renderExtent));
+        params["drawFraction"] = percentToDraw;
+        GpuProfiler::PushRegion(context, "Render tiles");
+        renderTiles(context, uint3(renderExtent, 1u), params, TileDefines(tileSize));
+        GpuProfiler::PopRegion(context);
+    }
+
+    // Counts a sample of the points by projected size, and updates the rasterizer choice from earlier frames' counts
+    inline void UpdateFootprint(CommandContext& context, const PointCloud& pointCloud, const Transform& sceneToCamera, const Transform& projection, const uint2 renderExtent) {
+        while (!footprintQueue.empty() && ContextTimeline::CurrentValue(context) >= footprintQueue.front().second) {
+            const BufferRange<uint32_t>& counts = footprintQueue.front().first;
+            if (counts[0] > 0) {
+                footprintFractions = float2(counts[1], counts[2]) / float(counts[0]);
+                // hysteresis, so the choice does not flicker while the median is near a threshold
+                if      (footprintFractions.x > 0.55f) autoCompute = true;
+                else if (footprintFractions.x < 0.45f) autoCompute = false;
+                if      (footprintFractions.y > 0.55f) smallSplatTiles = true;
+                else if (footprintFractions.y < 0.45f) smallSplatTiles = false;
+            }
+            freeFootprintCpu.emplace_back(counts);
+            footprintQueue.pop();
+        }
+
+        const uint32_t vertexCount = (uint32_t)pointCloud.size();
+        const TiledView view = TiledView::Create(sceneToCamera, projection, renderExtent);
+        const BufferRange<uint32_t> counts = context.GetTransientBuffer<uint32_t>(3, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
+        context.Fill(counts, 0u);
+
+        ShaderParameter params = {};
+        params["pointCloud"]     = pointCloud.GetShaderParameter();
+        params["pointSize"]      = pointSize;
+        params["views"]          = (BufferParameter)context.UploadData(std::span(&view, 1), vk::BufferUsageFlagBits::eStorageBuffer);
+        params["footprintStats"] = (BufferParameter)counts;
+        params["footprintThresholds"] = float2(computeRasterPixels, kSmallSplatTileSize / 2);
+        params["footprintStride"] = std::max(vertexCount / kFootprintSamples, 1u);
+        estimateFootprint(context, uint3(std::min(vertexCount, kFootprintSamples), 1, 1), params);
+
+        BufferRange<uint32_t> countsCpu = GetReadbackBuffer(freeFootprintCpu, context.GetDevice(), 3);
+        context.Copy(counts, countsCpu);
+        footprintQueue.push({ countsCpu, ContextTimeline::NextSignal(context) });
+    }
+
+	inline void Render(
+        CommandContext&   context,
+        const ImageView&  renderTarget,
+        const PointCloud& pointCloud,
+        const Transform&  sceneToCamera,
+        const Transform&  projection,
+        SortedPoints sorted = {}) {
+        const uint32_t vertexCount = (uint32_t)pointCloud.size();
+		if (vertexCount == 0)
+        {
+            context.ClearColor(renderTarget, vk::ClearColorValue{std::array<float,4>{ 0, 0, 0, 1 }});
+            return;
+        }
+
+        const uint2 renderExtent = renderTarget.Extent();
+
+        // sampled splat sizes choose the rasterizer in auto mode, and the compute rasterizer's tile size
+        if (rasterMode != RasterMode::eMeshShader || !meshShaders)
+            UpdateFootprint(context, pointCloud, sceneToCamera, projection, renderExtent);
+
+        // presorted points are drawn with the mesh shader path, if there is one
+        if (UseComputeRaster() && (!sorted || !meshShaders)) {
+            RenderTiled(context, renderTarget, pointCloud, sceneToCamera, projection, smallSplatTiles ? kSmallSplatTileSize : kTileSize);
+            return;
+        }
+
+        if (!sorted) sorted = Sort(context, pointCloud, sceneToCamera, projection, renderExtent, percentToDraw);
+
+        // prepare draw pipeline
+
+        Pipeline& drawPipeline = *rasterPoints.get(context.GetDevice(), ShaderDefines{}, GetRasterPipelineInfo(renderTarget.GetImage()->Info().format)).get();
         auto drawDescriptorSets = context.GetDescriptorSets(*drawPipeline.Layout());
 
         // prepare draw parameters
@@ -114,8 +533,8 @@ struct PointCloudRenderer {
             params["cameraUp"] = t.TransformVector(float3(0,1,0));
             params["outputExtent"] = renderExtent;
             params["pointCloud"] = pointCloud.GetShaderParameter();
-            params["pointCloud"]["numVertices"] = (uint32_t)(percentToDraw*vertexCount);
-            params["sortPairs"] = (BufferParameter)sortPairs;
+            params["sortPairs"] = (BufferParameter)sorted.sortPairs;
+            params["sortCounts"] = (BufferParameter)sorted.sortCounts;
             params["pointSize"] = pointSize;
 
             context.UpdateDescriptorSets(*drawDescriptorSets, params, *drawPipeline.Layout());
@@ -123,11 +542,16 @@ struct PointCloudRenderer {
 
         // rasterize points
 
+        GpuProfiler::PushRegion(context, "Rasterize points");
         context.AddBarrier(renderTarget, Image::ResourceState{
             .layout = vk::ImageLayout::eColorAttachmentOptimal,
             .stage  = vk::PipelineStageFlagBits2::eColorAttachmentOutput,
             .access =  vk::AccessFlagBits2::eColorAttachmentRead|vk::AccessFlagBits2::eColorAttachmentWrite,
             .queueFamily = context.QueueFamily() });
+        context.AddBarrier(sorted.sortCounts, Buffer::ResourceState{
+            .stage  = vk::PipelineStageFlagBits2::eDrawIndirect,
+            .access = vk::AccessFlagBits2::eIndirectCommandRead,
+            .queueFamily = context.QueueFamily() });
         context.ExecuteBarriers();
 
         vk::RenderingAttachmentInfo attachments[1] = {
@@ -152,10 +576,11 @@ struct PointCloudRenderer {
         context->bindPipeline(vk::PipelineBindPoint::eGraphics, **drawPipeline);
         context.BindDescriptors(*drawPipeline.Layout(), *drawDescriptorSets);
 
-        const uint32_t vertsPerGroup = drawPipeline.GetShader()->WorkgroupSize().x/4;
-        context->drawMeshTasksEXT((uint32_t(vertexCount*percentToDraw) + vertsPerGroup-1) / vertsPerGroup, 1, 1);
+        // draw the visible points, with the group count written by CreateSortPairs.cs.slang
+        context->drawMeshTasksIndirectEXT(**sorted.sortCounts.mBuffer, sorted.sortCounts.mOffset + 2*sizeof(uint32_t), 1, sizeof(vk::DrawMeshTasksIndirectCommandEXT));
     
         context->endRendering();
+        GpuProfiler::PopRegion(context);
 	}
 
 	inline void RenderGradients(
@@ -173,11 +598,18 @@ struct PointCloudRenderer {
             return;
         }
         
+        if (tiledGradients) {
+            const uint2 renderExtent = renderTarget.Extent();
+            const TiledView view = TiledView::Create(sceneToCamera, projection, renderExtent);
+            RenderGradientsBatch(context, renderTarget, pointCloud, std::span(&view, 1), GetSlotHeight(renderExtent.y), referenceImage, loss);
+            return;
+        }
+
         // sort points
-        BufferRange<uint2> sortPairs = Sort(context, pointCloud, sceneToCamera, projection);
-    
         const uint2 renderExtent = renderTarget.Extent();
 
+        const SortedPoints sorted = Sort(context, pointCloud, sceneToCamera, projection, renderExtent);
+
         ImageView pixelVertexCounts = ImageView::Create(context.GetTransientImage(
             uint3(renderExtent, 1),
             vk::Format::eR32Uint,
@@ -185,8 +617,8 @@ struct PointCloudRenderer {
 
         ShaderParameter params = {};
         params["pointCloud"] = pointCloud.GetShaderParameter();
-        params["pointCloud"]["numVertices"] = (uint32_t)(percentToDraw*vertexCount);
-        params["sortPairs"] = (BufferParameter)sortPairs;
+        params["sortPairs"] = (BufferParameter)sorted.sortPairs;
+        params["sortCounts"] = (BufferParameter)sorted.sortCounts;
         params["outputColor"] = ImageParameter{.image = renderTarget,   .imageLayout = vk::ImageLayout::eGeneral};
         params["reference" ]  = ImageParameter{.image = referenceImage, .imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal};
         params["outputLoss"] = (BufferParameter)loss;
@@ -197,10 +629,64 @@ struct PointCloudRenderer {
         params["pointSize"] = pointSize;
 
         // forward pass
+        GpuProfiler::PushRegion(context, "Render");
         computeRender(context, uint3(renderExtent,1u), params);
+        GpuProfiler::PopRegion(context);
 
         // backward pass
+        GpuProfiler::PushRegion(context, "Render backward");
         computeRenderBwd(context, uint3(renderExtent,1u), params, { { "OUTPUT_LOSS", loss ? "1" : "0" } });
+        GpuProfiler::PopRegion(context);
+    }
+
+    // Renders and backpropagates several views with the tiled renderer, in shared dispatches.
+    // View i occupies rows [i*slotHeight, i*slotHeight + extent.y) of renderTarget and referenceImage.
+    // Gradients of all views are summed into the point cloud's gradients, and their losses into loss.
+    inline void RenderGradientsBatch(
+        CommandContext&   context,
+        const ImageView&  renderTarget,
+        const PointCloud& pointCloud,
+        const std::span<const TiledView> views,
+        const uint32_t    slotHeight,
+        const ImageView&  referenceImage,
+        const BufferRange<float>& loss) {
+        const uint32_t vertexCount = (uint32_t)pointCloud.size();
+        if (vertexCount == 0 || views.empty()) {
+            context.ClearColor(renderTarget, vk::ClearColorValue{std::array<float,4>{ 0, 0, 0, 1 }});
+            return;
+        }
+
+        const bool partials = gradientPartials || deterministicGradients;
+        const uint2 renderExtent = renderTarget.Extent();
+        const TileBins bins = BinTiles(context, pointCloud, views, slotHeight, deterministicGradients);
+        ShaderParameter params = GetTiledShaderParameters(pointCloud, bins, renderTarget, CreatePixelVertexCounts(context, renderExtent));
+        params["reference"]  = ImageParameter{.image = referenceImage, .imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal};
+        params["outputLoss"] = (BufferParameter)loss;
+        if (partials) {
+            params["keySplatGradients"] = (BufferParameter)context.GetTransientBuffer<float4>(tileKeyCapacity, vk::BufferUsageFlagBits::eStorageBuffer);
+            params["keyColorGradients"] = (BufferParameter)context.GetTransientBuffer<float4>(tileKeyCapacity, vk::BufferUsageFlagBits::eStorageBuffer);
+        }
+        if (deterministicGradients)
+            params["tileLosses"] = (BufferParameter)context.GetTransientBuffer<float>(bins.tileCount.x * bins.tileCount.y, vk::BufferUsageFlagBits::eStorageBuffer);
+
+        const ShaderDefines defines = {
+            { "OUTPUT_LOSS", loss ? "1" : "0" },
+            { "GRADIENT_PARTIALS", partials ? "1" : "0" },
+            { "DETERMINISTIC_BINNING", deterministicGradients ? "1" : "0" } };
+
+        // forward pass
+        GpuProfiler::PushRegion(context, "Render tiles");
+        renderTiles(context, uint3(renderExtent, 1u), params);
+        GpuProfiler::PopRegion(context);
+
+        // backward pass
+        GpuProfiler::PushRegion(context, "Render tiles backward");
+        renderTilesBwd(context, uint3(renderExtent, 1u), params, defines);
+        if (partials)
+            reduceGradients(context, uint3(vertexCount, 1, 1), params, defines);
+        if (loss && deterministicGradients)
+            reduceLoss(context, uint3(256, 1, 1), params, defines);
+        GpuProfiler::PopRegion(context);
     }
 };
 
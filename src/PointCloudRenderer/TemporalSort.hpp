@@ -0,0 +1,163 @@
+#pragma once
+
+#include <queue>
+
+#include <Rose/Core/CommandContext.hpp>
+#include <Rose/Core/PipelineCache.hpp>
+#include <Rose/RadixSort/RadixSort.hpp>
+
+#include "Scene/PointCloudScene.hpp"
+#include "GpuProfiler.hpp"
+#include "ShaderPrecompiler.hpp"
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+struct SortedPoints {
+	BufferRange<uint2>    sortPairs;  // depth-sorted (key, vertexId) of the visible points
+	BufferRange<uint32_t> sortCounts; // visible count, draw count and mesh task indirect args (see CreateSortPairs.cs.slang)
+
+	inline operator bool() const { return sortPairs; }
+};
+
+// Keeps the previous frame's depth order and repairs it incrementally while the camera moves slowly.
+// Falls back to a full radix sort when the view changes past a threshold or too many inversions remain.
+struct TemporalSort {
+	PipelineCache initPairs       = PipelineCache(FindShaderPath("TemporalSort.cs.slang"), "initPairs");
+	PipelineCache updateKeys      = PipelineCache(FindShaderPath("TemporalSort.cs.slang"), "updateKeys");
+	PipelineCache repairBlocks    = PipelineCache(FindShaderPath("TemporalSort.cs.slang"), "repairBlocks");
+	PipelineCache measureDisorder = PipelineCache(FindShaderPath("TemporalSort.cs.slang"), "measureDisorder");
+	PipelineCache writeDrawArgs   = PipelineCache(FindShaderPath("CreateSortPairs.cs.slang"), "writeDrawArgs");
+	RadixSort radixSort;
+
+	static constexpr uint32_t kRepairBlockSize = 512; // REPAIR_BLOCK_SIZE in TemporalSort.cs.slang
+
+	bool     enabled            = true;
+	float    maxViewAngle       = 10.f;  // degrees rotated since the last full sort
+	float    maxViewTranslation = 0.5f;  // scene units moved since the last full sort
+	float    maxDisorder        = 1e-3f; // fraction of adjacent pairs out of order after repairing
+	uint32_t repairPasses       = 2;
+
+	BufferRange<uint2> sortPairs; // order of all points, persistent across frames
+	float4x4 fullSortView;
+	bool     fullSortRequested = true;
+	uint32_t framesSinceFullSort = 0;
+	float    disorder = 0;
+	std::queue<std::pair<BufferRange<uint32_t>, uint64_t>> disorderQueue;
+	std::vector<BufferRange<uint32_t>> freeDisorderCpu;
+
+	inline void Reset() {
+		sortPairs = {};
+		fullSortRequested = true;
+		disorderQueue = {};
+	}
+
+	inline void DrawGui() {
+		ImGui::Checkbox("Reuse sort", &enabled);
+		if (!enabled) return;
+		ImGui::DragFloat("Max view angle", &maxViewAngle, 0.1f, 0.f, 180.f);
+		ImGui::DragFloat("Max view translation", &maxViewTranslation, 0.01f, 0.f, 1000.f);
+		ImGui::DragFloat("Max disorder", &maxDisorder, 1e-4f, 0.f, 1.f, "%.4f");
+		ImGui::SliderInt("Repair passes", (int*)&repairPasses, 0, 8);
+		ImGui::Text("Frames since full sort: %u, disorder: %.5f", framesSinceFullSort, disorder);
+	}
+
+	// The radix sort's pipelines are built by Rose on first use
+	inline void Precompile(ShaderPrecompiler& precompiler) {
+		precompiler.Add(initPairs);
+		precompiler.Add(updateKeys);
+		precompiler.Add(repairBlocks);
+		precompiler.Add(measureDisorder);
+		precompiler.Add(writeDrawArgs);
+	}
+
+	inline bool ViewChanged(const float4x4& view) const {
+		auto forward  = [](const float4x4& v) { return normalize(float3(v[0][2], v[1][2], v[2][2])); };
+		auto position = [](const float4x4& v) { return -(transpose(float3x3(v)) * float3(v[3])); };
+		const float angle = glm::degrees(std::acos(std::clamp(dot(forward(view), forward(fullSortView)), -1.f, 1.f)));
+		return angle > maxViewAngle || length(position(view) - position(fullSortView)) > maxViewTranslation;
+	}
+
+	inline SortedPoints operator()(
+		CommandContext&   context,
+		const PointCloud& pointCloud,
+		const Transform&  sceneToCamera,
+		const Transform&  projection,
+		const uint2       renderExtent,
+		const float       pointSize,
+		const float       drawFraction,
+		const uint32_t    pointsPerMeshGroup) {
+		const uint32_t vertexCount = (uint32_t)pointCloud.size();
+
+		while (!disorderQueue.empty() && ContextTimeline::CurrentValue(context) >= disorderQueue.front().second) {
+			disorder = disorderQueue.front().first[0] / (float)std::max(vertexCount, 1u);
+			if (disorder > maxDisorder) fullSortRequested = true;
+			freeDisorderCpu.emplace_back(disorderQueue.front().first);
+			disorderQueue.pop();
+		}
+
+		bool fullSort = fullSortRequested || !sortPairs || sortPairs.size() != vertexCount || ViewChanged(sceneToCamera.transform);
+		if (fullSort) {
+			if (!sortPairs || sortPairs.size() != vertexCount)
+				sortPairs = Buffer::Create(context.GetDevice(), vertexCount*sizeof(uint2), vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst);
+			fullSortView = sceneToCamera.transform;
+			fullSortRequested = false;
+			framesSinceFullSort = 0;
+		} else
+			framesSinceFullSort++;
+
+		SortedPoints sorted = {
+			.sortPairs  = sortPairs,
+			.sortCounts = context.GetTransientBuffer<uint32_t>(5, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eIndirectBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst) };
+		BufferRange<uint32_t> inversions = context.GetTransientBuffer<uint32_t>(1, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
+
+		GpuProfiler::PushRegion(context, fullSort ? "Sort points" : "Repair sort");
+
+		context.Fill(sorted.sortCounts, 0u);
+		context.Fill(inversions, 0u);
+
+		ShaderParameter params = {};
+		params["sortPairs"]    = (BufferParameter)sortPairs;
+		params["sortCounts"]   = (BufferParameter)sorted.sortCounts;
+		params["disorder"]     = (BufferParameter)inversions;
+		params["vertices"]     = (BufferParameter)pointCloud.vertices.FullPrecisionData();
+		params["view"]         = sceneToCamera.transform;
+		params["projection"]   = projection.transform;
+		params["outputExtent"] = renderExtent;
+		params["pointSize"]    = pointSize;
+		params["vertexCount"]  = vertexCount;
+		params["zSign"]        = (int32_t)(projection.transform[2][2] > 0 ? 1 : -1);
+		params["drawFraction"] = drawFraction;
+		params["pointsPerMeshGroup"] = pointsPerMeshGroup;
+		params["sortedCount"]  = vertexCount;
+
+		if (fullSort) {
+			initPairs(context, uint3(vertexCount, 1, 1), params);
+			radixSort(context, sortPairs);
+		} else {
+			updateKeys(context, uint3(vertexCount, 1, 1), params);
+			// alternate block boundaries so points can move across them
+			for (uint32_t i = 0; i < repairPasses; i++) {
+				const uint32_t blockOffset = (i % 2) * (kRepairBlockSize/2);
+				if (blockOffset >= vertexCount) continue;
+				params["blockOffset"] = blockOffset;
+				const uint32_t numBlocks = (vertexCount - blockOffset + kRepairBlockSize - 1) / kRepairBlockSize;
+				repairBlocks(context, uint3(numBlocks * kRepairBlockSize/2, 1, 1), params);
+			}
+		}
+
+		measureDisorder(context, uint3(vertexCount, 1, 1), params);
+		writeDrawArgs(context, uint3(1, 1, 1), params);
+
+		BufferRange<uint32_t> inversionsCpu = GetReadbackBuffer(freeDisorderCpu, context.GetDevice());
+		context.Copy(inversions, inversionsCpu);
+		disorderQueue.push({ inversionsCpu, ContextTimeline::NextSignal(context) });
+
+		GpuProfiler::PopRegion(context);
+
+		return sorted;
+	}
+};
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <Rose/Core/CommandContext.hpp>
+#include <Rose/Core/PipelineCache.hpp>
+
+#include "ShaderPrecompiler.hpp"
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// In-place exclusive prefix sum of uints. The result is deterministic, so it can replace atomic
+// offset allocation wherever the output order must be reproducible.
+struct PrefixSum {
+	static constexpr uint32_t kBlockSize = 1024; // BLOCK_SIZE in PrefixSum.cs.slang
+
+	PipelineCache scanBlocks      = PipelineCache(FindShaderPath("PrefixSum.cs.slang"), "scanBlocks");
+	PipelineCache addBlockOffsets = PipelineCache(FindShaderPath("PrefixSum.cs.slang"), "addBlockOffsets");
+
+	inline void Precompile(ShaderPrecompiler& precompiler) {
+		precompiler.Add(scanBlocks);
+		precompiler.Add(addBlockOffsets);
+	}
+
+	inline void operator()(CommandContext& context, const BufferRange<uint32_t>& values) {
+		const uint32_t count = (uint32_t)values.size();
+		if (count == 0) return;
+
+		const uint32_t numBlocks = (count + kBlockSize - 1) / kBlockSize;
+		const BufferRange<uint32_t> blockSums = context.GetTransientBuffer<uint32_t>(numBlocks, vk::BufferUsageFlagBits::eStorageBuffer);
+
+		ShaderParameter params = {};
+		params["values"]    = (BufferParameter)values;
+		params["blockSums"] = (BufferParameter)blockSums;
+		params["count"]     = count;
+		scanBlocks(context, uint3(numBlocks * (kBlockSize/4), 1, 1), params);
+
+		if (numBlocks > 1) {
+			(*this)(context, blockSums);
+			addBlockOffsets(context, uint3(count, 1, 1), params);
+		}
+	}
+};
+
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <Rose/Core/CommandContext.hpp>
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Timeline values of a command context's submissions, which lagged readbacks and resource reuse compare against.
+// Contexts use the device timeline, unless they own a ContextTimeline. A context on another queue than the device
+// timeline's must own one: signals of one semaphore from several queues can complete out of order, so a value
+// signalled by one queue would mark earlier values of another queue as complete.
+class ContextTimeline {
+private:
+	vk::raii::Semaphore   mSemaphore = nullptr;
+	uint64_t              mLastSignal = 0;
+	const CommandContext* mContext = nullptr;
+
+	inline static std::unordered_map<const CommandContext*, const ContextTimeline*> sTimelines;
+
+	inline static const ContextTimeline* Find(const CommandContext& context) {
+		const auto it = sTimelines.find(&context);
+		return it == sTimelines.end() ? nullptr : it->second;
+	}
+
+public:
+	inline ContextTimeline(CommandContext& context) : mContext(&context) {
+		const vk::SemaphoreTypeCreateInfo typeInfo = {
+			.semaphoreType = vk::SemaphoreType::eTimeline,
+			.initialValue  = 0 };
+		mSemaphore = vk::raii::Semaphore(*context.GetDevice(), vk::SemaphoreCreateInfo{ .pNext = &typeInfo });
+		sTimelines[mContext] = this;
+	}
+	inline ~ContextTimeline() { sTimelines.erase(mContext); }
+	ContextTimeline(const ContextTimeline&) = delete;
+	ContextTimeline& operator=(const ContextTimeline&) = delete;
+
+	inline vk::Semaphore operator*() const { return *mSemaphore; }
+	inline uint64_t LastSignal() const { return mLastSignal; }
+	inline uint64_t Value() const { return mSemaphore.getCounterValue(); }
+
+	// Submits the context, signalling the next value. The submission starts once the device timeline reaches
+	// deviceWaitValue, so it sees the writes of work other queues submitted before.
+	inline uint64_t Submit(CommandContext& context, const uint64_t deviceWaitValue) {
+		const std::pair<vk::Semaphore, vk::PipelineStageFlags> wait = { *context.GetDevice().TimelineSemaphore(), vk::PipelineStageFlagBits::eAllCommands };
+		const uint64_t value = mLastSignal + 1;
+		context.Submit(0, *mSemaphore, value, wait, deviceWaitValue);
+		mLastSignal = value;
+		return value;
+	}
+
+	// Blocks until the last submission completed
+	inline void Wait() const {
+		if (Value() >= mLastSignal) return;
+		const vk::Semaphore semaphore = *mSemaphore;
+		(void)(*mContext->GetDevice()).waitSemaphores(vk::SemaphoreWaitInfo{
+			.semaphoreCount = 1,
+			.pSemaphores    = &semaphore,
+			.pValues        = &mLastSignal }, UINT64_MAX);
+	}
+
+	// Value the context's next submission signals
+	inline static uint64_t NextSignal(const CommandContext& context) {
+		const ContextTimeline* t = Find(context);
+		return t ? t->mLastSignal + 1 : context.GetDevice().NextTimelineSignal();
+	}
+	// Most recent value of the context's timeline whose submission completed
+	inline static uint64_t CurrentValue(const CommandContext& context) {
+		const ContextTimeline* t = Find(context);
+		return t ? t->Value() : context.GetDevice().CurrentTimelineValue();
+	}
+};
+
+// Host buffer for a lagged readback of count elements. Reuses one from freeBuffers, where completed readbacks
+// return their buffers, so readbacks recorded every frame do not allocate.
+template<typename T>
+inline BufferRange<T> GetReadbackBuffer(std::vector<BufferRange<T>>& freeBuffers, const Device& device, const size_t count = 1) {
+	while (!freeBuffers.empty()) {
+		const BufferRange<T> b = freeBuffers.back();
+		freeBuffers.pop_back();
+		if (b.size() >= count) return b;
+	}
+	return Buffer::Create(device, count*sizeof(T), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent, VMA_ALLOCATION_CREATE_MAPPED_BIT|VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+}
+
+// Queue families that access the point data, optimizer state and training images. With more than one (an async
+// trainer on a compute queue family), these resources are created with concurrent sharing, so moving training
+// between queues needs no queue family ownership transfers.
+struct SharedQueueFamilies {
+	inline static std::vector<uint32_t> queueFamilies;
+
+	inline static std::vector<uint32_t> Get(const CommandContext& context) {
+		return queueFamilies.size() > 1 ? queueFamilies : std::vector<uint32_t>{ context.QueueFamily() };
+	}
+
+	inline static BufferRange<std::byte> CreateBuffer(
+		const Device&                  device,
+		const vk::DeviceSize           size,
+		const vk::BufferUsageFlags     usage,
+		const vk::MemoryPropertyFlags  memoryFlags = vk::MemoryPropertyFlagBits::eDeviceLocal,
+		const VmaAllocationCreateFlags allocationFlags = 0) {
+		if (queueFamilies.size() < 2)
+			return Buffer::Create(device, size, usage, memoryFlags, allocationFlags);
+		return Buffer::Create(device, vk::BufferCreateInfo{
+			.size                  = size,
+			.usage                 = usage,
+			.sharingMode           = vk::SharingMode::eConcurrent,
+			.queueFamilyIndexCount = (uint32_t)queueFamilies.size(),
+			.pQueueFamilyIndices   = queueFamilies.data() }, memoryFlags, allocationFlags);
+	}
+};
+
+}
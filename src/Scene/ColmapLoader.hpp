@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <unordered_map>
+
+#include "PointCloudFile.hpp"
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Sequential reads from a memory mapped COLMAP binary file. Reads past the end set `failed` and return zeros.
+class ColmapReader {
+private:
+	MappedFile mFile;
+	size_t mOffset = 0;
+
+public:
+	bool failed = false;
+
+	inline ColmapReader(const std::filesystem::path& p) : mFile(p), failed(!mFile) {}
+
+	inline size_t Remaining() const { return mFile.size() - mOffset; }
+
+	template<typename T>
+	inline T Read() {
+		T v = {};
+		if (failed || sizeof(T) > Remaining()) {
+			failed = true;
+			return v;
+		}
+		std::memcpy(&v, mFile.data() + mOffset, sizeof(T));
+		mOffset += sizeof(T);
+		return v;
+	}
+
+	inline void Skip(const size_t bytes) {
+		if (failed || bytes > Remaining()) failed = true;
+		else mOffset += bytes;
+	}
+	// Skips count elements of stride bytes, failing instead of overflowing on corrupt counts
+	inline void Skip(const uint64_t count, const size_t stride) {
+		if (failed || count > Remaining() / stride) failed = true;
+		else mOffset += count * stride;
+	}
+
+	// Number of records the header count may claim, at most one per minRecordSize remaining bytes,
+	// so corrupt counts fail the read instead of the reserve
+	inline size_t MaxRecords(const size_t minRecordSize) const { return Remaining() / minRecordSize; }
+
+	inline std::string ReadString() {
+		std::string s;
+		while (!failed) {
+			const char c = Read<char>();
+			if (c == '\0') break;
+			s.push_back(c);
+		}
+		return s;
+	}
+};
+
+// A COLMAP sparse reconstruction (sparse/0/cameras.bin, images.bin and points3D.bin) read without the Python
+// converter. Views are sorted by image name and every kTestHold-th view is held out for testing, and view and
+// projection matrices are built like data/camera.py, so the scene matches what converter.py writes.
+// Lens distortion is ignored, as in the converter.
+struct ColmapScene {
+	static constexpr uint32_t kTestHold = 8; // llffhold in dataset_readers.py
+	static constexpr float    kNear = 0.01f;
+	static constexpr float    kFar  = 100.f;
+
+	std::vector<std::filesystem::path> imagePaths; // train views first
+	std::vector<float4x4> viewTransforms;
+	std::vector<float4x4> projectionTransforms;
+	uint32_t numTrainCameras = 0;
+	std::vector<float3> points;
+	std::vector<float4> colors;
+
+	// Matrices are indexed [row][col] of the ones in camera.py: the converter writes them transposed,
+	// and LoadJson reads its rows as float4x4 columns.
+
+	// World to camera transform from COLMAP's rotation rows and translation (getWorld2View2)
+	inline static float4x4 MakeViewTransform(const float3x3& rotationRows, const float3 translation) {
+		float4x4 v = float4x4(0);
+		for (uint32_t row = 0; row < 3; row++) {
+			for (uint32_t col = 0; col < 3; col++)
+				v[row][col] = rotationRows[row][col];
+			v[row][3] = translation[row];
+		}
+		v[3][3] = 1;
+		return v;
+	}
+
+	// Symmetric frustum with the fov of the focal lengths, in pixels (getProjectionMatrix)
+	inline static float4x4 MakeProjection(const float2 focal, const float2 extent) {
+		float4x4 p = float4x4(0);
+		p[0][0] = 2 * focal.x / extent.x;
+		p[1][1] = 2 * focal.y / extent.y;
+		p[2][2] = kFar / (kFar - kNear);
+		p[2][3] = -(kFar * kNear) / (kFar - kNear);
+		p[3][2] = 1;
+		return p;
+	}
+
+	// The reconstruction root for a directory containing sparse/0, or for a file in sparse/0. Empty otherwise.
+	inline static std::filesystem::path FindRoot(const std::filesystem::path& p) {
+		std::error_code ec;
+		if (std::filesystem::is_directory(p, ec)) {
+			if (std::filesystem::exists(p / "sparse" / "0" / "images.bin", ec)) return p;
+			if (std::filesystem::exists(p / "images.bin", ec) && p.parent_path().filename() == "sparse") return p.parent_path().parent_path();
+			return {};
+		}
+		if (p.extension() == ".bin" && std::filesystem::exists(p.parent_path() / "images.bin", ec) && p.parent_path().parent_path().filename() == "sparse")
+			return p.parent_path().parent_path().parent_path();
+		return {};
+	}
+
+	// Loads the reconstruction at root, with images from root/imageFolder, or from the first of images, images_2,
+	// images_4 and images_8 that exists.
+	inline bool Load(const std::filesystem::path& root, const std::string& imageFolder = "") {
+		const std::filesystem::path sparse = root / "sparse" / "0";
+
+		struct Intrinsics {
+			uint2  extent;
+			float2 focal;
+		};
+		std::unordered_map<int32_t, Intrinsics> cameras;
+		{
+			// parameter counts by model id, and whether the model has one focal length
+			static constexpr uint32_t kParamCounts[] = { 3, 4, 4, 5, 8, 8, 12, 5, 4, 5, 12 };
+			static constexpr bool     kSingleFocal[] = { true, false, true, true, false, false, false, false, true, true, false };
+
+			ColmapReader r(sparse / "cameras.bin");
+			const uint64_t count = r.Read<uint64_t>();
+			for (uint64_t i = 0; i < count && !r.failed; i++) {
+				const int32_t  id     = r.Read<int32_t>();
+				const int32_t  model  = r.Read<int32_t>();
+				const uint64_t width  = r.Read<uint64_t>();
+				const uint64_t height = r.Read<uint64_t>();
+				if (model < 0 || model >= (int32_t)std::size(kParamCounts)) {
+					std::cerr << "Unsupported COLMAP camera model " << model << std::endl;
+					return false;
+				}
+				std::vector<double> params(kParamCounts[model]);
+				for (double& v : params) v = r.Read<double>();
+				cameras[id] = Intrinsics{
+					.extent = uint2(width, height),
+					.focal  = float2(params[0], kSingleFocal[model] ? params[0] : params[1]) };
+			}
+			if (r.failed) {
+				std::cerr << "Failed to read " << sparse / "cameras.bin" << std::endl;
+				return false;
+			}
+		}
+
+		std::filesystem::path imageDir = root / imageFolder;
+		if (imageFolder.empty()) {
+			imageDir = root / "images";
+			for (const char* folder : { "images", "images_2", "images_4", "images_8" })
+				if (std::filesystem::is_directory(root / folder)) {
+					imageDir = root / folder;
+					break;
+				}
+		}
+
+		struct View {
+			std::string name; // file name without extension, the sort key
+			std::filesystem::path path;
+			float4x4 view;
+			float4x4 projection;
+		};
+		std::vector<View> views;
+		{
+			ColmapReader r(sparse / "images.bin");
+			const uint64_t count = r.Read<uint64_t>();
+			views.reserve(std::min<uint64_t>(count, r.MaxRecords(4 + 7*8 + 4 + 1 + 8)));
+			for (uint64_t i = 0; i < count && !r.failed; i++) {
+				r.Read<int32_t>(); // image id
+				double q[4], t[3];
+				for (double& v : q) v = r.Read<double>();
+				for (double& v : t) v = r.Read<double>();
+				const int32_t cameraId = r.Read<int32_t>();
+				const std::string file = std::filesystem::path(r.ReadString()).filename().string();
+				r.Skip(r.Read<uint64_t>(), 24); // 2D points: x, y, point3D id
+				if (r.failed) break;
+
+				const auto camera = cameras.find(cameraId);
+				if (camera == cameras.end()) {
+					std::cerr << "Image " << file << " references missing camera " << cameraId << std::endl;
+					return false;
+				}
+
+				// rotation rows of the (w, x, y, z) quaternion
+				const double w = q[0], x = q[1], y = q[2], z = q[3];
+				const float3x3 R = float3x3(
+					float3(1 - 2*y*y - 2*z*z, 2*x*y - 2*w*z,     2*z*x + 2*w*y),
+					float3(2*x*y + 2*w*z,     1 - 2*x*x - 2*z*z, 2*y*z - 2*w*x),
+					float3(2*z*x - 2*w*y,     2*y*z + 2*w*x,     1 - 2*x*x - 2*y*y));
+				const float4x4 worldToView = MakeViewTransform(R, float3(t[0], t[1], t[2]));
+				const float4x4 projection  = MakeProjection(camera->second.focal, float2(camera->second.extent));
+
+				std::string name = std::filesystem::path(file).stem().string();
+				name = name.substr(0, name.find('.'));
+				std::string pathName = file;
+				std::ranges::replace(pathName, ' ', '_');
+				views.emplace_back(View{ .name = name, .path = imageDir / pathName, .view = worldToView, .projection = projection });
+			}
+			if (r.failed) {
+				std::cerr << "Failed to read " << sparse / "images.bin" << std::endl;
+				return false;
+			}
+		}
+		std::ranges::stable_sort(views, {}, &View::name);
+
+		{
+			ColmapReader r(sparse / "points3D.bin");
+			const uint64_t count = r.Read<uint64_t>();
+			const size_t reserved = std::min<uint64_t>(count, r.MaxRecords(8 + 3*8 + 3 + 8 + 8));
+			points.reserve(reserved);
+			colors.reserve(reserved);
+			for (uint64_t i = 0; i < count && !r.failed; i++) {
+				r.Read<uint64_t>(); // point id
+				const double px = r.Read<double>(), py = r.Read<double>(), pz = r.Read<double>();
+				const uint8_t cr = r.Read<uint8_t>(), cg = r.Read<uint8_t>(), cb = r.Read<uint8_t>();
+				r.Read<double>(); // reprojection error
+				r.Skip(r.Read<uint64_t>(), 8); // track: image id, point2D index
+				points.emplace_back(float3(px, py, pz));
+				colors.emplace_back(float4(cr, cg, cb, 255) / 255.f);
+			}
+			if (r.failed) {
+				std::cerr << "Failed to read " << sparse / "points3D.bin" << std::endl;
+				return false;
+			}
+		}
+
+		// train views first, then the held out views
+		for (const bool test : { false, true }) {
+			for (uint32_t i = 0; i < views.size(); i++) {
+				if ((i % kTestHold == 0) != test) continue;
+				imagePaths.emplace_back(views[i].path);
+				viewTransforms.emplace_back(views[i].view);
+				projectionTransforms.emplace_back(views[i].projection);
+			}
+			if (!test) numTrainCameras = (uint32_t)imagePaths.size();
+		}
+		return true;
+	}
+};
+
+}
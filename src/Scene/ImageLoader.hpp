@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <stb_image.h>
+#include <Rose/Core/CommandContext.hpp>
+
+#include "QueueSync.hpp"
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Decodes image files on a pool of worker threads. Decoded pixels are handed to the main thread,
+// which copies them into a bounded ring of host-visible staging buffers and records the GPU uploads.
+// A staging buffer is reused once the submission that read it has completed, so decoding on the CPU
+// overlaps with uploads on the GPU.
+class ImageLoader {
+private:
+	struct DecodedImage {
+		uint32_t index;
+		uint2    extent;
+		stbi_uc* pixels;
+	};
+	struct StagingBuffer {
+		BufferRange<std::byte> buffer;
+		uint64_t timelineValue = 0;
+	};
+
+	std::vector<std::filesystem::path> mPaths;
+	std::vector<std::jthread> mWorkers;
+	std::atomic_uint32_t mNextJob = 0;
+
+	std::mutex mMutex;
+	std::condition_variable_any mQueueNotFull;
+	std::deque<DecodedImage> mDecoded;
+	size_t mMaxDecoded = 0;
+
+	std::vector<StagingBuffer> mStagingBuffers;
+	uint32_t mNumCompleted = 0;
+
+	inline void WorkerMain(std::stop_token stop) {
+		for (uint32_t i = mNextJob++; i < mPaths.size() && !stop.stop_requested(); i = mNextJob++) {
+			// bound the amount of decoded data waiting for upload
+			{
+				std::unique_lock lock(mMutex);
+				mQueueNotFull.wait(lock, stop, [&]() { return mDecoded.size() < mMaxDecoded; });
+				if (stop.stop_requested()) break;
+			}
+
+			int w = 0, h = 0, c = 0;
+			stbi_uc* pixels = stbi_load(mPaths[i].string().c_str(), &w, &h, &c, 4);
+			if (!pixels) std::cerr << "Failed to load " << mPaths[i] << ": " << stbi_failure_reason() << std::endl;
+
+			std::lock_guard lock(mMutex);
+			mDecoded.emplace_back(DecodedImage{ .index = i, .extent = uint2(w, h), .pixels = pixels });
+		}
+	}
+
+public:
+	ImageLoader() = default;
+	ImageLoader(const ImageLoader&) = delete;
+	ImageLoader& operator=(const ImageLoader&) = delete;
+
+	inline ImageLoader(std::vector<std::filesystem::path>&& paths, const uint32_t numStagingBuffers = 8, uint32_t numThreads = 0) : mPaths(std::move(paths)) {
+		if (numThreads == 0) numThreads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+		numThreads = std::min<uint32_t>(numThreads, (uint32_t)mPaths.size());
+
+		mStagingBuffers.resize(std::max(numStagingBuffers, 1u));
+		mMaxDecoded = mStagingBuffers.size() + numThreads;
+
+		mWorkers.reserve(numThreads);
+		for (uint32_t i = 0; i < numThreads; i++)
+			mWorkers.emplace_back([this](std::stop_token stop) { WorkerMain(stop); });
+	}
+
+	inline ~ImageLoader() {
+		for (auto& w : mWorkers) w.request_stop();
+		mWorkers.clear(); // joins
+		for (const DecodedImage& d : mDecoded)
+			if (d.pixels) stbi_image_free(d.pixels);
+	}
+
+	inline uint32_t NumCompleted() const { return mNumCompleted; }
+	inline uint32_t NumImages()    const { return (uint32_t)mPaths.size(); }
+	inline bool     Done()         const { return mNumCompleted == mPaths.size(); }
+	inline float    Progress()     const { return mPaths.empty() ? 1.f : mNumCompleted / (float)mPaths.size(); }
+
+	// Records uploads for decoded images into images[index], as long as a staging buffer is free.
+	// Must be called from the thread recording `context`. Returns the number of images completed by this call.
+	inline uint32_t Update(CommandContext& context, std::vector<ImageView>& images) {
+		const Device& device = context.GetDevice();
+		uint32_t count = 0;
+		while (!Done()) {
+			auto staging = std::ranges::find_if(mStagingBuffers, [&](const StagingBuffer& b) { return device.CurrentTimelineValue() >= b.timelineValue; });
+			if (staging == mStagingBuffers.end())
+				break;
+
+			DecodedImage d;
+			{
+				std::lock_guard lock(mMutex);
+				if (mDecoded.empty()) break;
+				d = mDecoded.front();
+				mDecoded.pop_front();
+			}
+			mQueueNotFull.notify_one();
+
+			mNumCompleted++;
+			count++;
+			if (!d.pixels) continue;
+
+			const size_t size = size_t(d.extent.x) * size_t(d.extent.y) * 4;
+			if (!staging->buffer || staging->buffer.size_bytes() < size)
+				staging->buffer = Buffer::Create(device, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent, VMA_ALLOCATION_CREATE_MAPPED_BIT|VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+			std::memcpy(staging->buffer.data(), d.pixels, size);
+			stbi_image_free(d.pixels);
+
+			const ImageView img = ImageView::Create(
+				Image::Create(device, ImageInfo{
+					.format = vk::Format::eR8G8B8A8Unorm,
+					.extent = uint3(d.extent, 1u),
+					.mipLevels = 1,
+					.queueFamilies = SharedQueueFamilies::Get(context) }));
+			if (img) context.Copy(staging->buffer.slice(0, size), img);
+			staging->timelineValue = device.NextTimelineSignal();
+
+			images[d.index] = img;
+		}
+		return count;
+	}
+
+	// Blocks until every image is uploaded, submitting `context` whenever the staging ring is exhausted.
+	inline void Finish(CommandContext& context, std::vector<ImageView>& images) {
+		while (!Done()) {
+			if (Update(context, images) > 0) continue;
+
+			const bool stagingFull = std::ranges::none_of(mStagingBuffers, [&](const StagingBuffer& b) { return context.GetDevice().CurrentTimelineValue() >= b.timelineValue; });
+			if (stagingFull) {
+				context.Submit();
+				context.GetDevice().Wait();
+				context.Begin();
+			} else
+				std::this_thread::yield();
+		}
+	}
+};
+
+}
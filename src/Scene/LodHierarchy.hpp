@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include <Rose/Core/CommandContext.hpp>
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Must match LodNode in Lod.cs.slang
+struct LodNode {
+	uint32_t parent;     // ~0u for the root
+	uint32_t firstChild; // children are contiguous
+	uint32_t childCount; // 0 for leaves
+	uint32_t firstPoint; // into LodHierarchy::pointIndices
+	uint32_t pointCount;
+	uint32_t pad[3];
+};
+static_assert(sizeof(LodNode) == 32);
+
+// Octree over the points of a point cloud, built on the CPU when points are loaded.
+// Points are sorted by the Morton code of their position, so every node covers a contiguous range of
+// pointIndices, and nodes are stored breadth first, so every level is a contiguous range of nodes.
+// Only the topology is stored; node bounds and proxy points are computed on the GPU from the live
+// point cloud (see PointCloudLod), so they follow the points while they are optimized.
+struct LodHierarchy {
+	static constexpr uint32_t kLeafSize = 64; // nodes with more points are subdivided
+	static constexpr uint32_t kMaxDepth = 21; // bits per axis of the Morton codes
+
+	BufferRange<LodNode>  nodes;
+	BufferRange<uint32_t> pointIndices;
+	std::vector<uint32_t> levelOffsets; // first node of each level, then the node count
+	uint32_t pointCount = 0;            // size of the point cloud this was built for
+
+	inline operator bool() const { return nodes; }
+	inline uint32_t NodeCount()  const { return levelOffsets.empty() ? 0 : levelOffsets.back(); }
+	inline uint32_t LevelCount() const { return levelOffsets.empty() ? 0 : (uint32_t)levelOffsets.size() - 1; }
+
+	// inserts two zero bits between each of the low 21 bits
+	inline static uint64_t SpreadBits(const uint32_t v) {
+		uint64_t x = v & 0x1FFFFF;
+		x = (x | x << 32) & 0x1F00000000FFFFull;
+		x = (x | x << 16) & 0x1F0000FF0000FFull;
+		x = (x | x << 8)  & 0x100F00F00F00F00Full;
+		x = (x | x << 4)  & 0x10C30C30C30C30C3ull;
+		x = (x | x << 2)  & 0x1249249249249249ull;
+		return x;
+	}
+
+	// (Morton code, point index) pairs sorted by code, over the bounds of the points. Non-finite points sort last.
+	inline static std::vector<std::pair<uint64_t, uint32_t>> SortByMortonCode(const std::span<const float3> vertices) {
+		float3 boundsMin = float3( std::numeric_limits<float>::infinity());
+		float3 boundsMax = float3(-std::numeric_limits<float>::infinity());
+		for (const float3& p : vertices) {
+			if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) continue;
+			boundsMin = min(boundsMin, p);
+			boundsMax = max(boundsMax, p);
+		}
+		const float3 scale = float3(float((1u << kMaxDepth) - 1)) / max(boundsMax - boundsMin, float3(1e-20f));
+
+		std::vector<std::pair<uint64_t, uint32_t>> keys(vertices.size());
+		for (uint32_t i = 0; i < vertices.size(); i++) {
+			const float3 p = vertices[i];
+			uint64_t code = ~0ull;
+			if (std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z)) {
+				const uint3 q = uint3(clamp((p - boundsMin) * scale, float3(0), float3(float((1u << kMaxDepth) - 1))));
+				code = SpreadBits(q.x) | (SpreadBits(q.y) << 1) | (SpreadBits(q.z) << 2);
+			}
+			keys[i] = { code, i };
+		}
+		std::ranges::sort(keys);
+		return keys;
+	}
+
+	inline void Build(CommandContext& context, const std::span<const float3> vertices) {
+		*this = {};
+		pointCount = (uint32_t)vertices.size();
+		if (pointCount == 0) return;
+
+		const std::vector<std::pair<uint64_t, uint32_t>> keys = SortByMortonCode(vertices);
+
+		std::vector<uint32_t> pointIndicesCpu(pointCount);
+		for (uint32_t i = 0; i < pointCount; i++)
+			pointIndicesCpu[i] = keys[i].second;
+
+		std::vector<LodNode>  nodesCpu   = { LodNode{ .parent = ~0u, .firstPoint = 0, .pointCount = pointCount } };
+		std::vector<uint32_t> nodeLevels = { 0 };
+		for (uint32_t i = 0; i < nodesCpu.size(); i++) {
+			const uint32_t level = nodeLevels[i];
+			if (levelOffsets.size() <= level) levelOffsets.emplace_back(i);
+
+			const LodNode node = nodesCpu[i];
+			if (node.pointCount <= kLeafSize || level >= kMaxDepth) continue;
+
+			// split the range at the octant bits of this level
+			const uint32_t shift = 3*(kMaxDepth - 1 - level);
+			const uint32_t firstChild = (uint32_t)nodesCpu.size();
+			const auto end = keys.begin() + node.firstPoint + node.pointCount;
+			for (auto it = keys.begin() + node.firstPoint; it != end;) {
+				const uint64_t prefix = it->first >> shift;
+				const auto next = std::partition_point(it, end, [&](const auto& k) { return (k.first >> shift) == prefix; });
+				nodesCpu.emplace_back(LodNode{
+					.parent     = i,
+					.firstPoint = (uint32_t)(it - keys.begin()),
+					.pointCount = (uint32_t)(next - it) });
+				nodeLevels.emplace_back(level + 1);
+				it = next;
+			}
+			nodesCpu[i].firstChild = firstChild;
+			nodesCpu[i].childCount = (uint32_t)nodesCpu.size() - firstChild;
+		}
+		levelOffsets.emplace_back((uint32_t)nodesCpu.size());
+
+		nodes        = context.UploadData(nodesCpu,        vk::BufferUsageFlagBits::eStorageBuffer);
+		pointIndices = context.UploadData(pointIndicesCpu, vk::BufferUsageFlagBits::eStorageBuffer);
+	}
+};
+
+}
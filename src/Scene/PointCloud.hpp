@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Adam/BufferGradient.hpp"
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Points given gradients by the backward passes of one optimizer step, so Adam can update only those.
+// Must match TouchedPoints in PointCloud.slang.
+struct TouchedPoints {
+	BufferRange<uint32_t> stamps; // per point, the stamp of the last step that touched it, 0 if none
+	BufferRange<uint32_t> list;   // count (padded to 8 bytes), then (point index, previous stamp) pairs
+	uint32_t stamp = 0;           // of the current step, 0 disables tracking
+
+	inline operator bool() const { return stamp != 0; }
+
+	inline ShaderParameter GetShaderParameter() const {
+		ShaderParameter params = {};
+		if (stamps) {
+			params["stamps"] = (BufferParameter)stamps;
+			params["list"]   = (BufferParameter)list;
+		}
+		params["stamp"] = stamp;
+		return params;
+	}
+};
+
+struct PointCloud {
+	BufferGradient<3> vertices;
+	BufferGradient<4> vertexColors;
+	TouchedPoints touched; // set by the trainer for sparse updates
+
+	inline vk::DeviceSize size() const { return vertices.size(); }
+	inline vk::DeviceSize size_bytes() const { return vertices.size_bytes() + vertexColors.size_bytes(); }
+
+	inline ShaderParameter GetShaderParameter() const {
+		ShaderParameter params = {};
+		params["vertices"]    = vertices.GetShaderParameter();
+		params["colors"]      = vertexColors.GetShaderParameter();
+		params["numVertices"] = (uint32_t)size();
+		params["touched"]     = touched.GetShaderParameter();
+		return params;
+	}
+};
+
+}
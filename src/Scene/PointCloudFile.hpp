@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string_view>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <Rose/Core/CommandContext.hpp>
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Binary scene container (.vkgs). All offsets are in bytes from the start of the file,
+// and every block is 16-byte aligned so it can be read in place from a memory mapping.
+//
+//   PointCloudFileHeader
+//   PointCloudFileCamera[numTrainCameras + numTestCameras]  (train cameras first)
+//   char[]   image names, referenced by PointCloudFileCamera::nameOffset
+//   float3[numPoints] positions
+//   float4[numPoints] colors
+struct PointCloudFileHeader {
+	static constexpr char     kMagic[4] = { 'V', 'K', 'G', 'S' };
+	static constexpr uint32_t kVersion  = 1;
+
+	char     magic[4];
+	uint32_t version;
+	uint32_t numTrainCameras;
+	uint32_t numTestCameras;
+	uint64_t numPoints;
+	uint64_t camerasOffset;
+	uint64_t stringsOffset;
+	uint64_t pointsOffset;
+	uint64_t colorsOffset;
+};
+static_assert(sizeof(PointCloudFileHeader) == 56);
+
+struct PointCloudFileCamera {
+	float4x4 view;       // column-major, same layout as float4x4
+	float4x4 projection; // column-major, same layout as float4x4
+	uint32_t nameOffset; // relative to PointCloudFileHeader::stringsOffset
+	uint32_t nameLength;
+	uint32_t pad[2];
+};
+static_assert(sizeof(PointCloudFileCamera) == 144);
+
+// Read-only memory mapping of an entire file.
+class MappedFile {
+private:
+	const std::byte* mData = nullptr;
+	size_t mSize = 0;
+#ifdef _WIN32
+	HANDLE mFile    = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = nullptr;
+#endif
+
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	inline MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+	inline MappedFile& operator=(MappedFile&& other) noexcept {
+		std::swap(mData, other.mData);
+		std::swap(mSize, other.mSize);
+#ifdef _WIN32
+		std::swap(mFile, other.mFile);
+		std::swap(mMapping, other.mMapping);
+#endif
+		return *this;
+	}
+
+	inline MappedFile(const std::filesystem::path& p) {
+#ifdef _WIN32
+		mFile = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (mFile == INVALID_HANDLE_VALUE) return;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0) return;
+		mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mMapping) return;
+		mData = (const std::byte*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+		if (mData) mSize = (size_t)size.QuadPart;
+#else
+		const int fd = open(p.c_str(), O_RDONLY);
+		if (fd < 0) return;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void* ptr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (ptr != MAP_FAILED) {
+				madvise(ptr, (size_t)st.st_size, MADV_SEQUENTIAL);
+				mData = (const std::byte*)ptr;
+				mSize = (size_t)st.st_size;
+			}
+		}
+		close(fd);
+#endif
+	}
+
+	inline ~MappedFile() {
+#ifdef _WIN32
+		if (mData) UnmapViewOfFile(mData);
+		if (mMapping) CloseHandle(mMapping);
+		if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+#else
+		if (mData) munmap((void*)mData, mSize);
+#endif
+	}
+
+	inline operator bool() const { return mData != nullptr; }
+	inline const std::byte* data() const { return mData; }
+	inline size_t size() const { return mSize; }
+
+	// Empty if the range does not fit in the file. Checked without overflow, since offsets and counts come from the file.
+	template<typename T>
+	inline std::span<const T> span(const uint64_t offset, const uint64_t count) const {
+		if (offset > mSize || count > (mSize - offset) / sizeof(T)) return {};
+		return std::span<const T>((const T*)(mData + offset), count);
+	}
+};
+
+// Validated view of a mapped .vkgs file. All accessors point into the mapping.
+struct PointCloudFile {
+	MappedFile file;
+	const PointCloudFileHeader* header = nullptr;
+	std::span<const PointCloudFileCamera> cameras;
+	std::span<const char>   strings;
+	std::span<const float3> points;
+	std::span<const float4> colors;
+
+	inline PointCloudFile(const std::filesystem::path& p) : file(p) {
+		if (!file || file.size() < sizeof(PointCloudFileHeader)) return;
+		const PointCloudFileHeader* h = (const PointCloudFileHeader*)file.data();
+		if (std::memcmp(h->magic, PointCloudFileHeader::kMagic, sizeof(h->magic)) != 0 || h->version != PointCloudFileHeader::kVersion) return;
+		// the strings end where the points start
+		if (h->pointsOffset < h->stringsOffset) return;
+
+		cameras = file.span<PointCloudFileCamera>(h->camerasOffset, (uint64_t)h->numTrainCameras + h->numTestCameras);
+		strings = file.span<char>(h->stringsOffset, h->pointsOffset - h->stringsOffset);
+		points  = file.span<float3>(h->pointsOffset, h->numPoints);
+		colors  = file.span<float4>(h->colorsOffset, h->numPoints);
+		if (cameras.size() != (uint64_t)h->numTrainCameras + h->numTestCameras || strings.size() != h->pointsOffset - h->stringsOffset ||
+			points.size() != h->numPoints || colors.size() != h->numPoints)
+			return;
+
+		header = h;
+	}
+
+	inline operator bool() const { return header != nullptr; }
+
+	inline std::string_view ImageName(const PointCloudFileCamera& c) const {
+		if ((uint64_t)c.nameOffset + c.nameLength > strings.size()) return {};
+		return std::string_view(strings.data() + c.nameOffset, c.nameLength);
+	}
+};
+
+inline bool IsPointCloudFile(const std::filesystem::path& p) {
+	std::ifstream fs(p, std::ios::binary);
+	char magic[4] = {};
+	fs.read(magic, sizeof(magic));
+	return fs && std::memcmp(magic, PointCloudFileHeader::kMagic, sizeof(magic)) == 0;
+}
+
+}
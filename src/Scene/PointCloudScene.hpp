@@ -1,28 +1,19 @@
 #pragma once
 
 #include <json.hpp>
+#include <iostream>
 #include <Rose/RadixSort/RadixSort.hpp>
-#include "Adam/BufferGradient.hpp"
+#include "PointCloud.hpp"
+#include "PointCloudFile.hpp"
+#include "ColmapLoader.hpp"
+#include "ImageLoader.hpp"
+#include "LodHierarchy.hpp"
+#include "PointStreamer.hpp"
 
 namespace vkgsplat {
 
 using namespace RoseEngine;
 
-struct PointCloud {
-	BufferGradient<3> vertices;
-	BufferGradient<4> vertexColors;
-
-	inline vk::DeviceSize size() const { return vertices.size(); }
-
-	inline ShaderParameter GetShaderParameter() const {
-		ShaderParameter params = {};
-		params["vertices"]    = vertices.GetShaderParameter();
-		params["colors"]      = vertexColors.GetShaderParameter();
-		params["numVertices"] = (uint32_t)size();
-		return params;
-	}
-};
-
 struct PointCloudScene {
 	std::vector<ImageView> images;
 	std::vector<float4x4>  viewTransformsCpu;
@@ -33,7 +24,89 @@ struct PointCloudScene {
 	PointCloud pointCloud;
 	uint32_t numTrainCameras;
 
-	inline void Load(CommandContext& context, const std::filesystem::path& p) {
+	// storage formats of the point attributes, applied when points are uploaded.
+	// sorting reads fp32 positions, so compact vertex data also keeps an fp32 master copy.
+	BufferGradientFormat vertexFormat = {};
+	BufferGradientFormat colorFormat  = {};
+
+	// level-of-detail octree over the loaded points, for interactive rendering
+	LodHierarchy lod;
+	bool buildLod = false;
+
+	// device memory for point data. When the loaded points need more, they are kept in host memory and
+	// pointCloud is a pool that the streamer pages spatial chunks into. 0 keeps every point resident.
+	size_t streamingBudget = 0;
+	std::unique_ptr<PointStreamer> streamer;
+
+	std::unique_ptr<ImageLoader> imageLoader;
+
+	// image folder of COLMAP reconstructions, relative to their root. Empty picks images, or a downscaled images_N.
+	std::string colmapImageFolder;
+
+	// Starts decoding the view images on worker threads. Entries in `images` stay null until UpdateLoading uploads them.
+	inline void LoadImages(std::vector<std::filesystem::path>&& paths) {
+		images.resize(paths.size());
+		imageLoader = std::make_unique<ImageLoader>(std::move(paths));
+	}
+	inline void LoadImages(const std::filesystem::path& imageDir, const std::vector<std::string>& imageNames) {
+		std::vector<std::filesystem::path> paths;
+		paths.reserve(imageNames.size());
+		for (const std::string& name : imageNames)
+			paths.emplace_back(imageDir / (name + ".JPG"));
+		LoadImages(std::move(paths));
+	}
+
+	// Records uploads for images decoded since the last call. Returns true once every view has been loaded.
+	inline bool UpdateLoading(CommandContext& context) {
+		if (!imageLoader) return true;
+		imageLoader->Update(context, images);
+		if (!imageLoader->Done()) return false;
+		imageLoader.reset();
+		return true;
+	}
+
+	inline float LoadProgress() const { return imageLoader ? imageLoader->Progress() : 1.f; }
+
+	inline void UploadPoints(CommandContext& context, const std::span<const float3> vertices, const std::span<const float4> vertexColors) {
+		BufferGradientFormat vf = vertexFormat;
+		if (!vf.ValidForPositions()) vf.data = BufferFormat::eFloat32;
+		lod = {};
+		streamer.reset();
+		if (streamingBudget > 0 && PointStreamer::DeviceBytesPerPoint(vf, colorFormat) * vertices.size() > streamingBudget) {
+			streamer = std::make_unique<PointStreamer>(context, vertices, vertexColors, vf, colorFormat, streamingBudget);
+			pointCloud = streamer->Pool();
+			return;
+		}
+		pointCloud.vertices     = BufferGradient<3>::Create(context, vertices, vf);
+		pointCloud.vertexColors = BufferGradient<4>::Create(context, vertexColors, colorFormat);
+		if (buildLod) lod.Build(context, vertices);
+	}
+
+	// Loads a binary .vkgs scene. Point blocks are copied straight from the file mapping into upload staging memory.
+	inline void LoadBinary(CommandContext& context, const std::filesystem::path& p) {
+		const PointCloudFile file(p);
+		if (!file) {
+			std::cerr << "Invalid scene file: " << p << std::endl;
+			return;
+		}
+
+		numTrainCameras = file.header->numTrainCameras;
+
+		std::vector<std::string> imageNames;
+		imageNames.reserve(file.cameras.size());
+		viewTransformsCpu.reserve(file.cameras.size());
+		projectionTransformsCpu.reserve(file.cameras.size());
+		for (const PointCloudFileCamera& c : file.cameras) {
+			imageNames.emplace_back(file.ImageName(c));
+			viewTransformsCpu.emplace_back(c.view);
+			projectionTransformsCpu.emplace_back(c.projection);
+		}
+
+		LoadImages(p.parent_path() / p.stem(), imageNames);
+		UploadPoints(context, file.points, file.colors);
+	}
+
+	inline void LoadJson(CommandContext& context, const std::filesystem::path& p) {
 		using namespace nlohmann;
 
 		auto json2float4x4 = [](const json& serialized) {
@@ -44,12 +117,6 @@ struct PointCloudScene {
 			return v;
 		};
 
-		const std::filesystem::path imageDir = p.parent_path() / p.stem();
-
-		images.clear();
-		viewTransformsCpu.clear();
-		projectionTransformsCpu.clear();
-		
 		std::ifstream fs(p);
 		const json pointCloudData = json::parse(fs);
 		const json trainCameras = pointCloudData["train_cameras"];
@@ -57,29 +124,20 @@ struct PointCloudScene {
 
 		numTrainCameras = (uint32_t)trainCameras.size();
 
-		images.reserve(trainCameras.size() + testCameras.size());
+		std::vector<std::string> imageNames;
+		imageNames.reserve(trainCameras.size() + testCameras.size());
 		viewTransformsCpu.reserve(trainCameras.size() + testCameras.size());
 		projectionTransformsCpu.reserve(trainCameras.size() + testCameras.size());
 
 		for (const auto& cameras : { trainCameras, testCameras }) {
-			for (const auto& c : cameras) {				
-					const PixelData d = LoadImageFile(context, imageDir / (c["image_name"].get<std::string>() + ".JPG"), false);
-					if (!d.data) continue;
-					const ImageView img = ImageView::Create(
-						Image::Create(context.GetDevice(), ImageInfo{
-							.format = d.format,
-							.extent = d.extent,
-							.mipLevels = 1,
-							.queueFamilies = { context.QueueFamily() } }));
-					if (img) context.Copy(d.data, img);
-					images.emplace_back(img);
-					viewTransformsCpu.emplace_back(json2float4x4(c["view"]));
-					projectionTransformsCpu.emplace_back(json2float4x4(c["projection"]));
+			for (const auto& c : cameras) {
+				imageNames.emplace_back(c["image_name"].get<std::string>());
+				viewTransformsCpu.emplace_back(json2float4x4(c["view"]));
+				projectionTransformsCpu.emplace_back(json2float4x4(c["projection"]));
 			}
 		}
 
-		viewTransforms       = context.UploadData(viewTransformsCpu,       vk::BufferUsageFlagBits::eStorageBuffer);
-		projectionTransforms = context.UploadData(projectionTransformsCpu, vk::BufferUsageFlagBits::eStorageBuffer);
+		LoadImages(p.parent_path() / p.stem(), imageNames);
 
 		std::vector<float3> vertices;
 		std::vector<float4> vertexColors;
@@ -88,18 +146,47 @@ struct PointCloudScene {
 		for (const auto& v : pointCloudData["points"]) vertices    .emplace_back(v[0].get<float>(), v[1].get<float>(), v[2].get<float>());
 		for (const auto& v : pointCloudData["colors"]) vertexColors.emplace_back(v[0].get<float>(), v[1].get<float>(), v[2].get<float>(), 1.0f);
 
-		auto createGradientBuf = [&]<int N>(const std::vector<glm::vec<N,float>>& data) {
-			auto buf = context.UploadData(data, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
-			return BufferGradient<N> {
-				.data      = buf,
-				.gradients = Buffer::Create(context.GetDevice(), buf.size_bytes(), vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst),
-				.moments1  = Buffer::Create(context.GetDevice(), buf.size_bytes(), vk::BufferUsageFlagBits::eStorageBuffer),
-				.moments2  = Buffer::Create(context.GetDevice(), buf.size_bytes(), vk::BufferUsageFlagBits::eStorageBuffer)
-			};
-		};
-		
-		pointCloud.vertices     = createGradientBuf(vertices);
-		pointCloud.vertexColors = createGradientBuf(vertexColors);
+		UploadPoints(context, vertices, vertexColors);
+	}
+
+	// Loads a COLMAP reconstruction from its binary files, without converting it to a scene file first
+	inline void LoadColmap(CommandContext& context, const std::filesystem::path& root) {
+		ColmapScene colmap;
+		if (!colmap.Load(root, colmapImageFolder)) {
+			std::cerr << "Invalid COLMAP reconstruction: " << root << std::endl;
+			return;
+		}
+		numTrainCameras         = colmap.numTrainCameras;
+		viewTransformsCpu       = std::move(colmap.viewTransforms);
+		projectionTransformsCpu = std::move(colmap.projectionTransforms);
+		LoadImages(std::move(colmap.imagePaths));
+		UploadPoints(context, colmap.points, colmap.colors);
+	}
+
+	// Loads a .vkgs or .json scene, or a COLMAP reconstruction (its root directory or a file in sparse/0).
+	// View images are decoded in parallel; unless `async` is set, this blocks until
+	// they are all uploaded. Otherwise call UpdateLoading every frame. Views whose image fails to load stay null.
+	inline void Load(CommandContext& context, const std::filesystem::path& p, const bool async = false) {
+		imageLoader.reset();
+		images.clear();
+		viewTransformsCpu.clear();
+		projectionTransformsCpu.clear();
+		numTrainCameras = 0;
+
+		if (const std::filesystem::path colmapRoot = ColmapScene::FindRoot(p); !colmapRoot.empty())
+			LoadColmap(context, colmapRoot);
+		else if (IsPointCloudFile(p))
+			LoadBinary(context, p);
+		else
+			LoadJson(context, p);
+
+		if (!async && imageLoader) {
+			imageLoader->Finish(context, images);
+			imageLoader.reset();
+		}
+
+		viewTransforms       = context.UploadData(viewTransformsCpu,       vk::BufferUsageFlagBits::eStorageBuffer);
+		projectionTransforms = context.UploadData(projectionTransformsCpu, vk::BufferUsageFlagBits::eStorageBuffer);
 	}
 };
 
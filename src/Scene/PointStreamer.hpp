@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <span>
+
+#include <Rose/Core/CommandContext.hpp>
+
+#include "PointCloud.hpp"
+#include "LodHierarchy.hpp"
+#include "GpuProfiler.hpp"
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Keeps a point cloud larger than device memory in host memory, and pages fixed-size spatial chunks of it
+// through a device pool that renderers and the optimizer use as an ordinary point cloud.
+// Chunks are runs of kChunkSize points in Morton order. Every Update scores the chunks by their projected size in
+// the requested views, scores of earlier requests decaying over time, and swaps the best non-resident chunks into
+// the slots of the worst resident ones. Pages are GPU copies recorded into the context, so paging never waits.
+// Chunks that were optimized while resident are copied back, with their moments, when they are evicted.
+// Unused pool slots hold NaN positions, which every renderer culls.
+class PointStreamer {
+public:
+	static constexpr uint32_t kChunkSize = 65536;
+
+	struct Stats {
+		uint64_t bytesIn   = 0;
+		uint64_t bytesOut  = 0;
+		uint32_t chunksIn  = 0;
+		uint32_t chunksOut = 0;
+
+		inline Stats& operator+=(const Stats& s) {
+			bytesIn += s.bytesIn; bytesOut += s.bytesOut; chunksIn += s.chunksIn; chunksOut += s.chunksOut;
+			return *this;
+		}
+	};
+	Stats lastUpdate = {};
+	Stats total      = {};
+
+	uint32_t maxPagesPerUpdate = 32;    // bounds the paging traffic of a single frame or step
+	float    scoreDecay        = 0.95f; // per update, so recently requested chunks stay resident
+	float    hysteresis        = 1.25f; // a chunk only replaces a resident one with a score this much lower
+
+private:
+	struct Chunk {
+		float3   center;
+		float    radius;
+		uint32_t slot  = ~0u;
+		float    score = 0;
+		bool     dirty = false; // optimized since it was paged in
+	};
+	// host copies of one attribute's buffers, in chunk order
+	struct HostAttribute {
+		BufferRange<std::byte> data;
+		BufferRange<std::byte> master;
+		BufferRange<std::byte> moments1;
+		BufferRange<std::byte> moments2;
+	};
+
+	std::vector<Chunk>    mChunks;
+	std::vector<uint32_t> mSlotChunks; // ~0u for free slots
+	HostAttribute mHostVertices;
+	HostAttribute mHostColors;
+	PointCloud    mPool;
+
+	inline static BufferRange<std::byte> CreateHostBuffer(const Device& device, const size_t size) {
+		return SharedQueueFamilies::CreateBuffer(device, std::max<size_t>(size, 4), vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent, VMA_ALLOCATION_CREATE_MAPPED_BIT|VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+	}
+
+	template<int N>
+	inline static HostAttribute CreateHostAttribute(const Device& device, const std::span<const glm::vec<N,float>> values, const BufferGradientFormat& format) {
+		HostAttribute h = {};
+		const std::vector<uint32_t> packed = BufferGradient<N>::PackValues(format.data, values);
+		h.data = CreateHostBuffer(device, packed.size() * sizeof(uint32_t));
+		std::memcpy(h.data.data(), packed.data(), packed.size() * sizeof(uint32_t));
+		if (format.HasMaster()) {
+			h.master = CreateHostBuffer(device, values.size_bytes());
+			std::memcpy(h.master.data(), values.data(), values.size_bytes());
+		}
+		h.moments1 = CreateHostBuffer(device, size_t(FormatStride(format.moments1, N)) * values.size());
+		h.moments2 = CreateHostBuffer(device, size_t(FormatStride(format.moments2, N)) * values.size());
+		std::memset(h.moments1.data(), 0, h.moments1.size_bytes());
+		std::memset(h.moments2.data(), 0, h.moments2.size_bytes());
+		return h;
+	}
+
+	// Copies a chunk's data, master and moments between host memory and a pool slot
+	template<int N>
+	inline static uint64_t CopyChunk(CommandContext& context, const HostAttribute& host, const BufferGradient<N>& pool, const uint32_t chunk, const uint32_t slot, const bool toHost) {
+		uint64_t bytes = 0;
+		auto copy = [&](const BufferRange<std::byte>& h, const BufferRange<std::byte>& d, const BufferFormat f) {
+			if (!h || !d) return;
+			const size_t size = size_t(FormatStride(f, N)) * kChunkSize;
+			if (toHost)
+				context.Copy(d.slice(slot * size, size), h.slice(chunk * size, size));
+			else
+				context.Copy(h.slice(chunk * size, size), d.slice(slot * size, size));
+			bytes += size;
+		};
+		copy(host.data,     pool.data,     pool.format.data);
+		copy(host.master,   pool.master,   BufferFormat::eFloat32);
+		copy(host.moments1, pool.moments1, pool.format.moments1);
+		copy(host.moments2, pool.moments2, pool.format.moments2);
+		return bytes;
+	}
+
+	// 32-bit word of NaNs in a storage format. unorm8 data cannot hold NaN, but always has an fp32 master.
+	inline static uint32_t NaNWord(const BufferFormat f) {
+		switch (f) {
+		case BufferFormat::eFloat16:  return 0x7E007E00u;
+		case BufferFormat::eBFloat16: return 0x7FC07FC0u;
+		case BufferFormat::eUnorm8:   return 0u;
+		default:                      return 0x7FC00000u;
+		}
+	}
+
+	inline void ClearSlot(CommandContext& context, const uint32_t slot) {
+		const BufferGradient<3>& v = mPool.vertices;
+		const size_t dataSize = size_t(FormatStride(v.format.data, 3)) * kChunkSize;
+		context.Fill(v.data.slice(slot * dataSize, dataSize).cast<uint32_t>(), NaNWord(v.format.data));
+		if (v.master)
+			context.Fill(v.master.slice(slot * sizeof(float3) * kChunkSize, sizeof(float3) * kChunkSize).cast<uint32_t>(), NaNWord(BufferFormat::eFloat32));
+	}
+
+	inline void ClearGradients(CommandContext& context, const uint32_t slot) {
+		auto clear = [&]<int N>(const BufferGradient<N>& b) {
+			const size_t size = size_t(FormatStride(b.format.gradients, N)) * kChunkSize;
+			context.Fill(b.gradients.slice(slot * size, size).cast<uint32_t>(), 0u);
+		};
+		clear(mPool.vertices);
+		clear(mPool.vertexColors);
+	}
+
+	inline void PageOut(CommandContext& context, const uint32_t slot) {
+		Chunk& c = mChunks[mSlotChunks[slot]];
+		if (c.dirty) {
+			lastUpdate.bytesOut += CopyChunk(context, mHostVertices, mPool.vertices,     mSlotChunks[slot], slot, true);
+			lastUpdate.bytesOut += CopyChunk(context, mHostColors,   mPool.vertexColors, mSlotChunks[slot], slot, true);
+			lastUpdate.chunksOut++;
+		}
+		c.slot  = ~0u;
+		c.dirty = false;
+		mSlotChunks[slot] = ~0u;
+	}
+
+	inline void PageIn(CommandContext& context, const uint32_t chunk, const uint32_t slot) {
+		lastUpdate.bytesIn += CopyChunk(context, mHostVertices, mPool.vertices,     chunk, slot, false);
+		lastUpdate.bytesIn += CopyChunk(context, mHostColors,   mPool.vertexColors, chunk, slot, false);
+		lastUpdate.chunksIn++;
+		ClearGradients(context, slot);
+		mChunks[chunk].slot = slot;
+		mSlotChunks[slot] = chunk;
+	}
+
+	// Projected size of the chunk's bounding sphere in a view, 0 outside of its frustum
+	inline float ViewScore(const Chunk& c, const float4x4& viewProjection) const {
+		const auto row = [&](const uint32_t i) { return float4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]); };
+		for (uint32_t i = 0; i < 4; i++) {
+			const float4 plane = row(3) + (i % 2 == 0 ? 1.f : -1.f) * row(i / 2);
+			if (dot(float3(plane), c.center) + plane.w < -c.radius * length(float3(plane)))
+				return 0;
+		}
+		const float w = dot(row(3), float4(c.center, 1));
+		if (w < -c.radius) return 0;
+		return c.radius / std::max(w, std::max(c.radius, 1e-6f));
+	}
+
+public:
+	PointStreamer() = default;
+	PointStreamer(const PointStreamer&) = delete;
+	PointStreamer& operator=(const PointStreamer&) = delete;
+
+	// Device bytes per point of a point cloud with these storage formats, including gradients
+	inline static size_t DeviceBytesPerPoint(const BufferGradientFormat& vf, const BufferGradientFormat& cf) {
+		auto bytes = [](const BufferGradientFormat& f, const uint32_t n) {
+			return size_t(FormatStride(f.data, n) + (f.HasMaster() ? n*4 : 0) + FormatStride(f.gradients, n) + FormatStride(f.moments1, n) + FormatStride(f.moments2, n));
+		};
+		return bytes(vf, 3) + bytes(cf, 4);
+	}
+
+	inline PointStreamer(CommandContext& context, const std::span<const float3> vertices, const std::span<const float4> vertexColors, BufferGradientFormat vertexFormat, BufferGradientFormat colorFormat, const size_t poolBytes) {
+		vertexFormat = vertexFormat.Resolved();
+		colorFormat  = colorFormat.Resolved();
+		const Device& device = context.GetDevice();
+
+		// reorder into whole chunks, padding the last one with NaN points
+		const uint32_t chunkCount = (uint32_t)((vertices.size() + kChunkSize - 1) / kChunkSize);
+		std::vector<float3> chunkVertices(size_t(chunkCount) * kChunkSize, float3(std::numeric_limits<float>::quiet_NaN()));
+		std::vector<float4> chunkColors(size_t(chunkCount) * kChunkSize, float4(0));
+		{
+			const std::vector<std::pair<uint64_t, uint32_t>> keys = LodHierarchy::SortByMortonCode(vertices);
+			for (size_t i = 0; i < keys.size(); i++) {
+				chunkVertices[i] = vertices[keys[i].second];
+				chunkColors[i]   = vertexColors[keys[i].second];
+			}
+		}
+
+		mChunks.resize(chunkCount);
+		for (uint32_t i = 0; i < chunkCount; i++) {
+			float3 boundsMin = float3( std::numeric_limits<float>::infinity());
+			float3 boundsMax = float3(-std::numeric_limits<float>::infinity());
+			for (uint32_t j = 0; j < kChunkSize; j++) {
+				const float3 p = chunkVertices[size_t(i) * kChunkSize + j];
+				if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) continue;
+				boundsMin = min(boundsMin, p);
+				boundsMax = max(boundsMax, p);
+			}
+			if (boundsMin.x > boundsMax.x) boundsMin = boundsMax = float3(0);
+			mChunks[i].center = (boundsMin + boundsMax) / 2.f;
+			mChunks[i].radius = length(boundsMax - boundsMin) / 2.f;
+		}
+
+		mHostVertices = CreateHostAttribute<3>(device, chunkVertices, vertexFormat);
+		mHostColors   = CreateHostAttribute<4>(device, chunkColors,   colorFormat);
+
+		const size_t chunkBytes = DeviceBytesPerPoint(vertexFormat, colorFormat) * kChunkSize;
+		const uint32_t slotCount = (uint32_t)std::clamp<size_t>(poolBytes / chunkBytes, 1, chunkCount);
+		mSlotChunks.resize(slotCount, ~0u);
+		mPool.vertices     = BufferGradient<3>::Allocate(context, slotCount * kChunkSize, vertexFormat);
+		mPool.vertexColors = BufferGradient<4>::Allocate(context, slotCount * kChunkSize, colorFormat);
+		for (uint32_t slot = 0; slot < slotCount; slot++)
+			ClearSlot(context, slot);
+	}
+
+	inline const PointCloud& Pool() const { return mPool; }
+	inline uint32_t ChunkCount()    const { return (uint32_t)mChunks.size(); }
+	inline uint32_t SlotCount()     const { return (uint32_t)mSlotChunks.size(); }
+	inline uint32_t ResidentCount() const { return (uint32_t)std::ranges::count_if(mSlotChunks, [](const uint32_t c) { return c != ~0u; }); }
+	inline size_t   HostBytes() const {
+		size_t bytes = 0;
+		for (const HostAttribute* h : { &mHostVertices, &mHostColors })
+			for (const BufferRange<std::byte>* b : { &h->data, &h->master, &h->moments1, &h->moments2 })
+				if (*b) bytes += b->size_bytes();
+		return bytes;
+	}
+
+	// Makes the chunks seen by the views resident, as far as the pool and maxPagesPerUpdate allow.
+	// Records the page copies into context, before any work that uses the pool in these views.
+	inline void Update(CommandContext& context, const std::span<const float4x4> viewProjections) {
+		lastUpdate = {};
+
+		for (Chunk& c : mChunks) {
+			float score = 0;
+			for (const float4x4& vp : viewProjections)
+				score = std::max(score, ViewScore(c, vp));
+			c.score = std::max(score, c.score * scoreDecay);
+		}
+
+		// best non-resident chunks first, free slots and then the worst resident chunks as victims
+		std::vector<uint32_t> candidates;
+		for (uint32_t i = 0; i < mChunks.size(); i++)
+			if (mChunks[i].slot == ~0u && mChunks[i].score > 0)
+				candidates.emplace_back(i);
+		const size_t candidateCount = std::min<size_t>(candidates.size(), maxPagesPerUpdate);
+		std::partial_sort(candidates.begin(), candidates.begin() + candidateCount, candidates.end(), [&](const uint32_t a, const uint32_t b) { return mChunks[a].score > mChunks[b].score; });
+
+		std::vector<uint32_t> victims(mSlotChunks.size());
+		for (uint32_t i = 0; i < victims.size(); i++) victims[i] = i;
+		auto slotScore = [&](const uint32_t slot) { return mSlotChunks[slot] == ~0u ? -1.f : mChunks[mSlotChunks[slot]].score; };
+		std::ranges::sort(victims, [&](const uint32_t a, const uint32_t b) { return slotScore(a) < slotScore(b); });
+
+		GpuProfiler::PushRegion(context, "Page points");
+		for (size_t i = 0; i < candidateCount && i < victims.size(); i++) {
+			const uint32_t slot = victims[i];
+			if (mSlotChunks[slot] != ~0u) {
+				if (slotScore(slot) * hysteresis >= mChunks[candidates[i]].score) break;
+				PageOut(context, slot);
+			}
+			PageIn(context, candidates[i], slot);
+		}
+		GpuProfiler::PopRegion(context);
+
+		total += lastUpdate;
+	}
+
+	// Marks the resident chunks as modified, e.g. after an optimizer step, so they are written back when evicted
+	inline void MarkResidentDirty() {
+		for (const uint32_t chunk : mSlotChunks)
+			if (chunk != ~0u) mChunks[chunk].dirty = true;
+	}
+
+	inline void DrawGui() {
+		ImGui::Text("Resident chunks: %u/%u (%u slots)", ResidentCount(), ChunkCount(), SlotCount());
+		const auto&[hostNumber,hostUnit] = FormatNumber(HostBytes());
+		ImGui::Text("%.2f%sB host backing store", hostNumber, hostUnit);
+		const auto&[inNumber,inUnit]   = FormatNumber(lastUpdate.bytesIn);
+		const auto&[outNumber,outUnit] = FormatNumber(lastUpdate.bytesOut);
+		ImGui::Text("Last update: %u in (%.2f%sB), %u out (%.2f%sB)", lastUpdate.chunksIn, inNumber, inUnit, lastUpdate.chunksOut, outNumber, outUnit);
+		const auto&[totalInNumber,totalInUnit]   = FormatNumber(total.bytesIn);
+		const auto&[totalOutNumber,totalOutUnit] = FormatNumber(total.bytesOut);
+		ImGui::Text("Total: %.2f%sB in, %.2f%sB out", totalInNumber, totalInUnit, totalOutNumber, totalOutUnit);
+		ImGui::DragScalar("Max pages per update", ImGuiDataType_U32, &maxPagesPerUpdate);
+		ImGui::SliderFloat("Score decay", &scoreDecay, 0.f, 1.f);
+	}
+};
+
+}
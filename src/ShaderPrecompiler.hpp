@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+#include <Rose/Core/PipelineCache.hpp>
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Builds shader variants on a background thread at startup, so Slang compilation and pipeline creation overlap
+// with loading the scene instead of stalling the first frame that renders, trains or draws an input view.
+// Components register their variants with a Precompile method, which must list the defines they dispatch with.
+// PipelineCache is not thread safe: registered pipelines must not be used until Done() returns true.
+// The driver's pipeline cache is saved to disk once every variant is built and merged into the device's cache on the
+// next start, so pipeline creation after the Slang compile of each variant hits the driver cache.
+class ShaderPrecompiler {
+private:
+	std::vector<std::function<void(Device&)>> mJobs;
+	std::atomic_uint32_t mCompleted = 0;
+	std::atomic_uint32_t mFailed    = 0;
+	std::atomic<double>  mSeconds   = 0;
+	bool mStarted = false;
+	std::jthread mThread;
+
+public:
+	inline void Add(std::function<void(Device&)> job) { mJobs.emplace_back(std::move(job)); }
+	inline void Add(PipelineCache& pipeline, const ShaderDefines& defines = {}) {
+		Add([&pipeline, defines](Device& device) { pipeline.get(device, defines); });
+	}
+
+	// The user's cache directory, or the temp directory if it has none.
+	inline static std::filesystem::path CacheDirectory() {
+		std::filesystem::path dir;
+#ifdef _WIN32
+		if (const char* localAppData = std::getenv("LOCALAPPDATA")) dir = std::filesystem::path(localAppData) / "vkgsplat";
+#else
+		if (const char* xdgCache = std::getenv("XDG_CACHE_HOME"); xdgCache && *xdgCache) dir = std::filesystem::path(xdgCache) / "vkgsplat";
+		else if (const char* home = std::getenv("HOME")) dir = std::filesystem::path(home) / ".cache" / "vkgsplat";
+#endif
+		std::error_code ec;
+		if (!dir.empty()) std::filesystem::create_directories(dir, ec);
+		if (dir.empty() || ec) return std::filesystem::temp_directory_path();
+		return dir;
+	}
+
+	// Named by the device's pipelineCacheUUID and driver version, so devices and drivers don't overwrite each other's cache.
+	inline static std::filesystem::path DefaultCachePath(const Device& device) {
+		const vk::PhysicalDeviceProperties props = device.PhysicalDevice().getProperties();
+		std::ostringstream name;
+		name << "pipeline_cache_" << std::hex;
+		for (const uint8_t b : props.pipelineCacheUUID)
+			name << (b >> 4) << (b & 0xF);
+		name << "_" << props.driverVersion << ".bin";
+		return CacheDirectory() / name.str();
+	}
+
+	// Merges a pipeline cache blob saved by SavePipelineCache into the device's cache. Blobs written by another
+	// device or driver version are ignored.
+	inline static bool LoadPipelineCache(const Device& device, const std::filesystem::path& path) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) return false;
+		const std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		// header: length, version, vendor id, device id, pipelineCacheUUID
+		const vk::PhysicalDeviceProperties props = device.PhysicalDevice().getProperties();
+		const size_t headerSize = 16 + VK_UUID_SIZE;
+		uint32_t header[4];
+		if (data.size() < headerSize) return false;
+		std::memcpy(header, data.data(), sizeof(header));
+		if (header[1] != (uint32_t)vk::PipelineCacheHeaderVersion::eOne || header[2] != props.vendorID || header[3] != props.deviceID ||
+			std::memcmp(data.data() + 16, props.pipelineCacheUUID.data(), VK_UUID_SIZE) != 0)
+			return false;
+
+		try {
+			const vk::raii::PipelineCache loaded(*device, vk::PipelineCacheCreateInfo{
+				.initialDataSize = data.size(),
+				.pInitialData    = data.data() });
+			device.PipelineCache().merge(*loaded);
+		} catch (const std::exception& e) {
+			std::cerr << "Failed to load pipeline cache " << path << ": " << e.what() << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	inline static void SavePipelineCache(const Device& device, const std::filesystem::path& path) {
+		try {
+			const std::vector<uint8_t> data = device.PipelineCache().getData();
+			std::ofstream file(path, std::ios::binary);
+			file.write(reinterpret_cast<const char*>(data.data()), data.size());
+		} catch (const std::exception& e) {
+			std::cerr << "Failed to save pipeline cache " << path << ": " << e.what() << std::endl;
+		}
+	}
+
+	inline uint32_t JobCount()  const { return (uint32_t)mJobs.size(); }
+	inline uint32_t Completed() const { return mCompleted; }
+	inline bool     Done()      const { return !mStarted || mCompleted == mJobs.size(); }
+
+	// Compiles every registered variant. Failures are reported and compiled again, and rethrown, on first use.
+	// The pipeline cache is loaded from cachePath before and saved after compiling, by default to DefaultCachePath.
+	// Pass an empty path to disable it.
+	inline void Start(const ref<Device>& device, const std::optional<std::filesystem::path>& cachePathOpt = std::nullopt) {
+		const std::filesystem::path cachePath = cachePathOpt.value_or(DefaultCachePath(*device));
+		mStarted = true;
+		if (!cachePath.empty()) LoadPipelineCache(*device, cachePath);
+		mThread = std::jthread([this, device, cachePath](std::stop_token stop) {
+			const auto t0 = std::chrono::steady_clock::now();
+			for (const auto& job : mJobs) {
+				if (stop.stop_requested()) break;
+				try {
+					job(*device);
+				} catch (const std::exception& e) {
+					std::cerr << "Failed to precompile shader: " << e.what() << std::endl;
+					mFailed++;
+				}
+				mCompleted++;
+			}
+			mSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			if (!cachePath.empty() && !stop.stop_requested()) SavePipelineCache(*device, cachePath);
+		});
+	}
+
+	inline void Wait() {
+		if (mThread.joinable()) mThread.join();
+	}
+
+	inline void DrawGui() const {
+		if (!mStarted) return;
+		if (!Done()) {
+			ImGui::Text("Compiling shaders: %u/%u", Completed(), JobCount());
+			ImGui::ProgressBar(JobCount() > 0 ? Completed() / float(JobCount()) : 1.f);
+		} else
+			ImGui::Text("Compiled %u shader variants in %.2fs", JobCount(), mSeconds.load());
+		if (mFailed > 0)
+			ImGui::Text("%u variants failed to compile", mFailed.load());
+	}
+};
+
+}
@@ -0,0 +1,299 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include "HeadlessContext.hpp"
+#include "GpuProfiler.hpp"
+#include "Trainer/Trainer.hpp"
+
+using namespace vkgsplat;
+using namespace RoseEngine;
+
+// Headless optimization of a scene. Runs a fixed number of Adam iterations without a window and prints
+// throughput, per-pass timings and the final loss as JSON, so training speed can be tracked across changes.
+//
+//   vkgsplat-train <scene> [--iterations N] [--warmup N] [--profile-iterations N] [--resolution-scale S]
+//                          [--batch-size N] [--step-size S] [--position-step-scale S] [--color-step-scale S] [--unfused-adam]
+//                          [--sparse-adam] [--atomic-gradients] [--deterministic] [--vertex-storage PRESET] [--color-storage PRESET]
+//                          [--densify] [--densify-interval N] [--max-points N] [--stream-budget MIB] [--loss-sampling] [--patch-scale S]
+//                          [--precompile] [--colmap-images DIR] [--device NAME] [--seed N] [--output FILE] [--trace FILE]
+//
+// <scene> is a .vkgs or .json file, or a COLMAP reconstruction directory whose images are in --colmap-images.
+// Storage presets are fp32 and compact-moments, and for colors also compact and unorm8 (see BufferGradientFormat::FromPreset).
+// With --stream-budget, points that need more device memory are paged through a pool of that size (see PointStreamer).
+// With --sparse-adam, each step only updates the points the backward pass gave gradients.
+// With --loss-sampling, views and patches of --patch-scale times their size are drawn in proportion to their loss.
+// With --precompile, every shader variant is compiled on a background thread while the scene loads.
+
+struct TrainArgs {
+	std::filesystem::path scene;
+	std::filesystem::path output;
+	std::filesystem::path trace;
+	std::string device;
+	std::string colmapImages;
+	uint32_t iterations        = 1000;
+	uint32_t warmup            = 10;
+	uint32_t profileIterations = 20;
+	uint32_t seed              = 0;
+	float    resolutionScale   = 0.25f;
+	uint32_t batchSize         = 1;
+	float    stepSize          = -1;
+	float    vertexStepScale   = 1;
+	float    colorStepScale    = 1;
+	bool     fusedAdam         = true;
+	bool     sparseAdam        = false;
+	bool     lossSampling      = false;
+	float    patchScale        = 0.5f;
+	bool     gradientPartials  = true;
+	bool     deterministic     = false;
+	bool     densify           = false;
+	uint32_t densifyInterval   = 100;
+	uint32_t maxPoints         = 4'000'000;
+	uint32_t streamBudget      = 0; // MiB
+	bool     precompile        = false;
+	BufferGradientFormat vertexFormat = {};
+	BufferGradientFormat colorFormat  = {};
+
+	inline bool Parse(int argc, const char** argv) {
+		for (int i = 1; i < argc; i++) {
+			const std::string_view arg = argv[i];
+			auto next = [&]() -> const char* {
+				if (i + 1 >= argc) {
+					std::cerr << "Missing value for " << arg << std::endl;
+					return nullptr;
+				}
+				return argv[++i];
+			};
+			const char* v = nullptr;
+			if      (arg == "--iterations")         { if (!(v = next())) return false; iterations = std::stoul(v); }
+			else if (arg == "--warmup")             { if (!(v = next())) return false; warmup = std::stoul(v); }
+			else if (arg == "--profile-iterations") { if (!(v = next())) return false; profileIterations = std::stoul(v); }
+			else if (arg == "--seed")               { if (!(v = next())) return false; seed = std::stoul(v); }
+			else if (arg == "--resolution-scale")   { if (!(v = next())) return false; resolutionScale = std::stof(v); }
+			else if (arg == "--batch-size")         { if (!(v = next())) return false; batchSize = std::max<uint32_t>(std::stoul(v), 1); }
+			else if (arg == "--step-size")          { if (!(v = next())) return false; stepSize = std::stof(v); }
+			else if (arg == "--position-step-scale") { if (!(v = next())) return false; vertexStepScale = std::stof(v); }
+			else if (arg == "--color-step-scale")   { if (!(v = next())) return false; colorStepScale = std::stof(v); }
+			else if (arg == "--unfused-adam")       fusedAdam = false;
+			else if (arg == "--sparse-adam")        sparseAdam = true;
+			else if (arg == "--loss-sampling")      lossSampling = true;
+			else if (arg == "--patch-scale")        { if (!(v = next())) return false; patchScale = std::stof(v); }
+			else if (arg == "--atomic-gradients")   gradientPartials = false;
+			else if (arg == "--deterministic")      deterministic = true;
+			else if (arg == "--densify")            densify = true;
+			else if (arg == "--densify-interval")   { if (!(v = next())) return false; densifyInterval = std::stoul(v); }
+			else if (arg == "--max-points")         { if (!(v = next())) return false; maxPoints = std::stoul(v); }
+			else if (arg == "--stream-budget")      { if (!(v = next())) return false; streamBudget = std::stoul(v); }
+			else if (arg == "--precompile")         precompile = true;
+			else if (arg == "--vertex-storage" || arg == "--color-storage") {
+				if (!(v = next())) return false;
+				const auto f = BufferGradientFormat::FromPreset(v);
+				if (!f) {
+					std::cerr << "Unknown storage preset " << v << std::endl;
+					return false;
+				}
+				if (arg == "--vertex-storage" && !f->ValidForPositions()) {
+					std::cerr << "Storage preset " << v << " is only valid for colors, positions keep fp32 data" << std::endl;
+					return false;
+				}
+				(arg == "--vertex-storage" ? vertexFormat : colorFormat) = *f;
+			}
+			else if (arg == "--device")             { if (!(v = next())) return false; device = v; }
+			else if (arg == "--colmap-images")      { if (!(v = next())) return false; colmapImages = v; }
+			else if (arg == "--output")             { if (!(v = next())) return false; output = v; }
+			else if (arg == "--trace")              { if (!(v = next())) return false; trace = v; }
+			else if (arg.starts_with("--")) {
+				std::cerr << "Unknown argument " << arg << std::endl;
+				return false;
+			} else
+				scene = arg;
+		}
+		return !scene.empty();
+	}
+};
+
+int main(int argc, const char** argv) {
+	TrainArgs args;
+	if (!args.Parse(argc, argv)) {
+		std::cerr << "Usage: " << argv[0] << " <scene> [--iterations N] [--warmup N] [--profile-iterations N] [--resolution-scale S] [--batch-size N] [--step-size S] [--position-step-scale S] [--color-step-scale S] [--unfused-adam] [--sparse-adam] [--loss-sampling] [--patch-scale S] [--atomic-gradients] [--deterministic] [--vertex-storage PRESET] [--color-storage PRESET] [--densify] [--densify-interval N] [--max-points N] [--stream-budget MIB] [--precompile] [--colmap-images DIR] [--device NAME] [--seed N] [--output FILE] [--trace FILE]" << std::endl;
+		return 1;
+	}
+
+	HeadlessContext h = HeadlessContext::Create(args.device, { VK_EXT_SHADER_ATOMIC_FLOAT_EXTENSION_NAME }, { VK_EXT_MESH_SHADER_EXTENSION_NAME });
+	if (!h) return 1;
+	CommandContext& context = *h.context;
+
+	PointCloudScene    scene;
+	scene.vertexFormat = args.vertexFormat;
+	scene.colorFormat  = args.colorFormat;
+	scene.streamingBudget = size_t(args.streamBudget) << 20;
+	scene.colmapImageFolder = args.colmapImages;
+	PointCloudRenderer renderer;
+	renderer.meshShaders            = h.HasExtension(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+	renderer.gradientPartials       = args.gradientPartials;
+	renderer.deterministicGradients = args.deterministic;
+	Trainer            trainer;
+	trainer.resolutionScale = args.resolutionScale;
+	trainer.batchSize       = args.batchSize;
+	if (args.stepSize >= 0) trainer.adam.stepSize = args.stepSize;
+	trainer.vertexStepScale = args.vertexStepScale;
+	trainer.colorStepScale  = args.colorStepScale;
+	trainer.fusedAdam       = args.fusedAdam;
+	trainer.sparseAdam      = args.sparseAdam;
+	trainer.sampler.enabled    = args.lossSampling;
+	trainer.sampler.patchScale = args.patchScale;
+	trainer.densify.enabled   = args.densify;
+	trainer.densify.interval  = args.densifyInterval;
+	trainer.densify.maxPoints = args.maxPoints;
+
+	ShaderPrecompiler precompiler;
+	if (args.precompile) {
+		renderer.Precompile(precompiler, vk::Format::eR16G16B16A16Sfloat);
+		trainer.Precompile(precompiler);
+		precompiler.Start(h.device);
+	}
+
+	const auto loadStart = std::chrono::high_resolution_clock::now();
+	context.Begin();
+	scene.Load(context, args.scene);
+	context.Submit();
+	h.device->Wait();
+	const double loadTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - loadStart).count();
+
+	// time spent waiting for shaders that were not done compiling by the time the scene loaded
+	const auto precompileStart = std::chrono::high_resolution_clock::now();
+	precompiler.Wait();
+	const double precompileWaitTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - precompileStart).count();
+
+	if (scene.numTrainCameras == 0 || !scene.pointCloud.vertices) {
+		std::cerr << "Failed to load " << args.scene << std::endl;
+		return 1;
+	}
+	for (uint32_t i = 0; i < scene.numTrainCameras; i++) {
+		if (!scene.images[i]) {
+			std::cerr << "Missing training view " << i << std::endl;
+			return 1;
+		}
+	}
+
+	srand(args.seed);
+	context.Begin();
+	trainer.SaveInitialState(context, scene);
+
+	// per-pass GPU timestamps of isolated steps. The sort is the one RenderGradients runs: the tile key sort of
+	// the tiled renderer, or the depth sort of the per-pixel path.
+	const char* sortRegion = renderer.tiledGradients ? "Sort tile keys" : "Sort points";
+	GpuProfiler passProfiler(*h.device, context.QueueFamily());
+	passProfiler.windowSize = std::max(args.profileIterations, 1u);
+	passProfiler.recordTrace = false;
+	passProfiler.SetActive(context);
+	// at t == 0, the Adam kernels skip loading gradients and moments, so time a later step
+	trainer.adam.t = 1;
+	for (uint32_t i = 0; i < args.profileIterations; i++) {
+		const uint32_t imageIndex = rand() % scene.numTrainCameras;
+		const Transform view = Transform{ scene.viewTransformsCpu[imageIndex] };
+		const Transform proj = Transform{ scene.projectionTransformsCpu[imageIndex] };
+		const ImageView& refImg = trainer.GetReferenceImage(context, scene, imageIndex);
+		const ImageView& target = trainer.GetRenderTarget(context, uint2(refImg.Extent()));
+		const BufferRange<float> lossBuf = context.GetTransientBuffer<float>(1, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst);
+		context.Fill(lossBuf, 0.f);
+		scene.pointCloud.vertices.clearGradients(context);
+		scene.pointCloud.vertexColors.clearGradients(context);
+		trainer.gradientsCleared = false;
+
+		GpuProfiler::PushRegion(context, "Render gradients");
+		renderer.RenderGradients(context, target, scene.pointCloud, view, proj, refImg, lossBuf);
+		GpuProfiler::PopRegion(context);
+		GpuProfiler::PushRegion(context, "Adam");
+		trainer.StepAdam(context, scene);
+		GpuProfiler::PopRegion(context);
+		// the profiled steps are discarded with their moments, and Reset below restores t, so timing does not
+		// change the optimization
+		scene.pointCloud.vertices.Restore(context, trainer.initialVertices);
+		scene.pointCloud.vertexColors.Restore(context, trainer.initialVertexColors);
+		h.Flush();
+		passProfiler.Update();
+	}
+	const nlohmann::json passTimes = {
+		{ "sort",            passProfiler.Average(sortRegion) },
+		{ "renderGradients", passProfiler.Average("Render gradients") },
+		{ "adam",            passProfiler.Average("Adam") },
+	};
+	trainer.Reset();
+
+	for (uint32_t i = 0; i < args.warmup; i++)
+		trainer.Step(context, scene, renderer);
+	h.Flush();
+
+	// GPU timestamps of the labelled passes of the timed steps
+	GpuProfiler profiler(*h.device, context.QueueFamily());
+	profiler.windowSize = std::max(args.iterations, 1u);
+	profiler.SetActive(context);
+
+	const uint32_t startIteration = trainer.adam.t;
+	const auto trainStart = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < args.iterations; i++) {
+		trainer.Step(context, scene, renderer);
+		// submit regularly so the GPU is never starved and transient allocations are recycled
+		if ((i % 16) == 15) {
+			context.Submit();
+			context.Begin();
+			profiler.Update();
+		}
+	}
+	context.Submit();
+	h.device->Wait();
+	profiler.Update();
+	const double trainTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - trainStart).count();
+	trainer.UpdateLoss(context);
+
+	const uint32_t iterations = trainer.adam.t - startIteration;
+
+	nlohmann::json result = {
+		{ "scene", args.scene.string() },
+		{ "device", h.deviceName },
+		{ "points", trainer.initialPointCount },
+		{ "finalPoints", scene.pointCloud.size() },
+		{ "pointBytes", scene.pointCloud.size_bytes() },
+		{ "trainViews", scene.numTrainCameras },
+		{ "resolutionScale", trainer.resolutionScale },
+		{ "batchSize", trainer.batchSize },
+		{ "fusedAdam", trainer.fusedAdam },
+		{ "sparseAdam", trainer.UseSparseAdam(scene) },
+		{ "lossSampling", trainer.sampler.enabled },
+		{ "patchScale", trainer.sampler.enabled ? trainer.sampler.patchScale : 1.f },
+		{ "gradientPartials", renderer.gradientPartials },
+		{ "deterministic", renderer.deterministicGradients },
+		{ "iterations", iterations },
+		{ "loadSeconds", loadTime },
+		{ "precompileWaitSeconds", precompileWaitTime },
+		{ "trainSeconds", trainTime },
+		{ "iterationsPerSecond", iterations / trainTime },
+		{ "viewsPerSecond", iterations * trainer.batchSize / trainTime },
+		{ "passMilliseconds", passTimes },
+		{ "gpuMilliseconds", profiler.AveragesJson() },
+		{ "finalLoss", trainer.lastLoss },
+		{ "smoothedLoss", trainer.currentLoss },
+	};
+
+	if (scene.streamer) {
+		const PointStreamer& s = *scene.streamer;
+		result["streaming"] = {
+			{ "chunks",    s.ChunkCount() },
+			{ "slots",     s.SlotCount() },
+			{ "hostBytes", s.HostBytes() },
+			{ "bytesIn",   s.total.bytesIn },
+			{ "bytesOut",  s.total.bytesOut },
+			{ "chunksIn",  s.total.chunksIn },
+			{ "chunksOut", s.total.chunksOut },
+		};
+	}
+
+	if (!args.trace.empty() && !profiler.WriteChromeTrace(args.trace))
+		std::cerr << "Failed to write " << args.trace << std::endl;
+	if (!args.output.empty()) {
+		std::ofstream(args.output) << result.dump(4) << std::endl;
+	}
+	std::cout << result.dump(4) << std::endl;
+	return 0;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <array>
+
+#include "Trainer.hpp"
+#include "QueueSync.hpp"
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Runs a Trainer on its own command context, on an async compute queue when the device has one, so training is
+// not serialized with the UI on one queue and is not limited to one step per displayed frame.
+// Every Update records stepsPerFrame steps, copies the point data into one of two snapshots and submits, unless
+// maxInFlight submissions are still running. The viewport draws the newest snapshot whose copy has completed, and
+// never the scene's points while training is in flight (see Wait).
+//
+// Submissions signal the trainer's own timeline, since signals of the device timeline from two queues could
+// complete out of order. Each submission waits on the GPU for the work the viewport submitted before it (reference
+// blits, scene uploads, frames that drew the snapshot being overwritten), and the viewport only draws a snapshot once
+// the host has seen its copy complete, so neither queue blocks the other. Resources both queues access are shared
+// concurrently between their families (see SharedQueueFamilies).
+class AsyncTrainer {
+private:
+	struct Snapshot {
+		PointCloud pointCloud;
+		uint64_t readyValue = 0; // on mTimeline, signalled once the copy completed
+		uint64_t drawnValue = 0; // on the viewport's timeline, signalled once the last frame that drew it completed
+	};
+
+	uint32_t            mQueueFamily;
+	ref<CommandContext> mContext;
+	ContextTimeline     mTimeline; // signalled by mContext's submissions only
+	PointCloudRenderer  mRenderer; // lagged readbacks of the renderer are per context
+	GpuProfiler         mProfiler; // active on mContext
+	std::array<Snapshot, 2> mSnapshots;
+	int32_t mNewest  = -1; // snapshot with the most recent copy, may still be in flight
+	int32_t mVisible = -1; // most recent snapshot whose copy has completed
+	std::queue<uint64_t> mInFlight; // on mTimeline
+
+	float    mPreparedScale = 0;
+	uint32_t mPreparedViews = 0;
+	uint64_t mReferencesReadyValue = 0;
+
+	// Copies data (and the fp32 master) of b into a snapshot buffer. Gradients and moments alias the data,
+	// since the snapshot is only rendered.
+	template<int N>
+	inline void CopyData(const BufferGradient<N>& b, BufferGradient<N>& dst) {
+		if (!dst || dst.count != b.count || dst.format.data != b.format.data || (bool)dst.master != (bool)b.master) {
+			const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst;
+			const BufferRange<std::byte> data = SharedQueueFamilies::CreateBuffer(mContext->GetDevice(), b.data.size_bytes(), usage);
+			dst = BufferGradient<N>{ .data = data, .gradients = data, .moments1 = data, .moments2 = data, .format = b.format, .count = b.count };
+			if (b.master) dst.master = SharedQueueFamilies::CreateBuffer(mContext->GetDevice(), b.master.size_bytes(), usage);
+		}
+		mContext->Copy(b.data, dst.data);
+		if (b.master) mContext->Copy(b.master, dst.master);
+	}
+
+	// Downscaled references are blitted on the graphics queue, since compute queues cannot blit.
+	// Returns false until the blits have completed. Submissions wait for them on the GPU as well (see Update).
+	inline bool PrepareReferences(CommandContext& graphicsContext, const PointCloudScene& scene, Trainer& trainer) {
+		uint32_t loadedViews = 0;
+		for (uint32_t i = 0; i < scene.numTrainCameras; i++)
+			if (scene.images[i]) loadedViews++;
+		if (trainer.resolutionScale != mPreparedScale || loadedViews != mPreparedViews) {
+			for (uint32_t i = 0; i < scene.numTrainCameras; i++)
+				if (scene.images[i]) trainer.GetReferenceImage(graphicsContext, scene, i);
+			mPreparedScale = trainer.resolutionScale;
+			mPreparedViews = loadedViews;
+			mReferencesReadyValue = ContextTimeline::NextSignal(graphicsContext);
+		}
+		return ContextTimeline::CurrentValue(graphicsContext) >= mReferencesReadyValue && loadedViews == scene.numTrainCameras;
+	}
+
+public:
+	uint32_t stepsPerFrame = 4;
+	uint32_t maxInFlight   = 2;
+
+	// A queue family with compute but no graphics support, or fallbackQueueFamily
+	inline static uint32_t FindAsyncComputeQueueFamily(const Device& device, const uint32_t fallbackQueueFamily) {
+		const auto queueFamilies = device.PhysicalDevice().getQueueFamilyProperties();
+		for (uint32_t i = 0; i < queueFamilies.size(); i++)
+			if ((queueFamilies[i].queueFlags & vk::QueueFlagBits::eCompute) && !(queueFamilies[i].queueFlags & vk::QueueFlagBits::eGraphics))
+				return i;
+		return fallbackQueueFamily;
+	}
+
+	// Construct before loading a scene, so its buffers are shared with the compute queue family
+	inline AsyncTrainer(const ref<Device>& device, const uint32_t graphicsQueueFamily) :
+		mQueueFamily(FindAsyncComputeQueueFamily(*device, graphicsQueueFamily)),
+		mContext(CommandContext::Create(device, mQueueFamily)),
+		mTimeline(*mContext),
+		mProfiler(*device, mQueueFamily) {
+		mProfiler.SetActive(*mContext);
+		if (mQueueFamily != graphicsQueueFamily)
+			SharedQueueFamilies::queueFamilies = { graphicsQueueFamily, mQueueFamily };
+	}
+
+	inline void Precompile(ShaderPrecompiler& precompiler, const vk::Format colorFormat, const bool meshShaders = true) {
+		mRenderer.meshShaders = meshShaders;
+		mRenderer.Precompile(precompiler, colorFormat);
+	}
+
+	inline uint32_t QueueFamily() const { return mQueueFamily; }
+	inline bool     Busy() const { return mTimeline.Value() < mTimeline.LastSignal(); }
+
+	// Blocks until the submitted training work completed. Call before anything but training uses the scene's
+	// points, e.g. once training stops or moves to the viewport's context.
+	inline void Wait() {
+		mTimeline.Wait();
+		mInFlight = {};
+	}
+
+	// Forgets the snapshots, e.g. when a scene is loaded. Call after the device is idle.
+	inline void Reset() {
+		mSnapshots = {};
+		mNewest  = -1;
+		mVisible = -1;
+		mInFlight = {};
+		mPreparedScale = 0;
+		mPreparedViews = 0;
+	}
+
+	// Records and submits the next training steps, if the queue is not saturated
+	inline void Update(CommandContext& graphicsContext, PointCloudScene& scene, Trainer& trainer, const PointCloudRenderer& renderer) {
+		const uint64_t completed = mTimeline.Value();
+		while (!mInFlight.empty() && completed >= mInFlight.front())
+			mInFlight.pop();
+		if (mNewest >= 0 && completed >= mSnapshots[mNewest].readyValue)
+			mVisible = mNewest;
+		mProfiler.Update();
+
+		if (mInFlight.size() >= maxInFlight || !PrepareReferences(graphicsContext, scene, trainer))
+			return;
+
+		mRenderer.pointSize              = renderer.pointSize;
+		mRenderer.tiledGradients         = renderer.tiledGradients;
+		mRenderer.gradientPartials       = renderer.gradientPartials;
+		mRenderer.deterministicGradients = renderer.deterministicGradients;
+
+		// the last value the viewport's queue submitted. Its frame being recorded is not submitted yet.
+		const uint64_t graphicsSubmitted = ContextTimeline::NextSignal(graphicsContext) - 1;
+
+		mContext->Begin();
+		for (uint32_t i = 0; i < std::max(stepsPerFrame, 1u); i++)
+			trainer.Step(*mContext, scene, mRenderer);
+
+		// snapshot into the buffer the viewport is not drawing, unless the frame being recorded drew it
+		Snapshot& s = mSnapshots[mVisible == 0 ? 1 : 0];
+		if (s.drawnValue <= graphicsSubmitted) {
+			GpuProfiler::PushRegion(*mContext, "Snapshot points");
+			CopyData(scene.pointCloud.vertices,     s.pointCloud.vertices);
+			CopyData(scene.pointCloud.vertexColors, s.pointCloud.vertexColors);
+			GpuProfiler::PopRegion(*mContext);
+			s.readyValue = mTimeline.LastSignal() + 1;
+			mNewest = mVisible == 0 ? 1 : 0;
+		}
+
+		mInFlight.push(mTimeline.Submit(*mContext, graphicsSubmitted));
+	}
+
+	// The most recent complete snapshot of the point data, or nullptr. Marks it as drawn by graphicsContext's next submission.
+	inline const PointCloud* GetSnapshot(CommandContext& graphicsContext) {
+		if (mVisible < 0) return nullptr;
+		mSnapshots[mVisible].drawnValue = ContextTimeline::NextSignal(graphicsContext);
+		return &mSnapshots[mVisible].pointCloud;
+	}
+
+	inline void DrawGui() {
+		ImGui::DragScalar("Steps per frame", ImGuiDataType_U32, &stepsPerFrame);
+		ImGui::DragScalar("Max submissions in flight", ImGuiDataType_U32, &maxInFlight);
+		ImGui::Text("Queue family %u", QueueFamily());
+		if (ImGui::TreeNode("Training GPU timings")) {
+			mProfiler.DrawGui();
+			ImGui::TreePop();
+		}
+	}
+};
+
+}
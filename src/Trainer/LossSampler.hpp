@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <span>
+#include <vector>
+
+#include <Rose/Core/CommandContext.hpp>
+#include <Rose/Render/ViewportCamera.hpp>
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Samples training views, and patches of them, in proportion to their recent loss.
+// Keeps a running per-pixel loss per view and per cell of a kGrid x kGrid grid over each view, from the lagged
+// loss readback of the steps that sampled them. Views and cells that were never sampled weigh as much as the
+// largest known loss, so every view is visited early on, and a uniformWeight share of the samples is uniform so
+// converged views are still revisited.
+struct LossSampler {
+	static constexpr uint32_t kGrid = 4;
+
+	bool  enabled       = false;
+	float patchScale    = 0.5f; // side of the patches relative to the view. 1 renders whole views.
+	float uniformWeight = 0.2f;
+	float decay         = 0.8f; // weight of the previous running loss
+
+	struct Sample {
+		uint32_t imageIndex;
+		uint2    extent; // of the whole view
+		uint4    crop;   // x, y, width, height in pixels
+	};
+
+	std::vector<float> viewLosses; // negative until sampled
+	std::vector<float> cellLosses; // kGrid*kGrid per view, row major
+
+	inline void Reset() {
+		viewLosses.clear();
+		cellLosses.clear();
+	}
+
+	inline static float Random() { return rand() / (float(RAND_MAX) + 1); }
+
+	// Index drawn in proportion to the losses mixed with uniformWeight. Excluded indices are never drawn,
+	// unless all of them are.
+	inline uint32_t SampleIndex(const std::span<const float> losses, const std::span<const uint32_t> exclude = {}) const {
+		float maxLoss = 0;
+		for (const float l : losses) maxLoss = std::max(maxLoss, l);
+		if (maxLoss <= 0) maxLoss = 1;
+
+		std::vector<float> weights(losses.size());
+		float lossSum = 0;
+		for (uint32_t i = 0; i < losses.size(); i++) {
+			if (std::ranges::find(exclude, i) != exclude.end()) continue;
+			weights[i] = losses[i] < 0 ? maxLoss : losses[i];
+			lossSum += weights[i];
+		}
+		const uint32_t candidates = (uint32_t)(losses.size() - std::min(exclude.size(), losses.size()));
+		if (candidates == 0) return rand() % (uint32_t)losses.size();
+		float total = 0;
+		for (uint32_t i = 0; i < losses.size(); i++) {
+			if (std::ranges::find(exclude, i) != exclude.end()) continue;
+			weights[i] = (1 - uniformWeight) * (lossSum > 0 ? weights[i] / lossSum : 0) + uniformWeight / candidates;
+			total += weights[i];
+		}
+
+		float x = Random() * total;
+		uint32_t last = 0;
+		for (uint32_t i = 0; i < losses.size(); i++) {
+			if (weights[i] <= 0) continue;
+			last = i;
+			if (x < weights[i]) return i;
+			x -= weights[i];
+		}
+		return last;
+	}
+
+	inline uint32_t SampleView(const uint32_t viewCount, const std::span<const uint32_t> exclude) {
+		if (viewLosses.size() != viewCount) {
+			viewLosses.assign(viewCount, -1.f);
+			cellLosses.assign(size_t(viewCount) * kGrid * kGrid, -1.f);
+		}
+		return SampleIndex(viewLosses, exclude);
+	}
+
+	// A patch of patchScale times the view's size, around a random pixel of a cell drawn by loss
+	inline uint4 SampleCrop(const uint32_t imageIndex, const uint2 extent) const {
+		const uint2 patch = clamp(uint2(float2(extent) * patchScale), uint2(1), extent);
+		if (patch.x == extent.x && patch.y == extent.y)
+			return uint4(0, 0, extent);
+
+		const uint32_t cell = SampleIndex(std::span(cellLosses).subspan(size_t(imageIndex) * kGrid * kGrid, kGrid * kGrid));
+		const float2 center = (float2(cell % kGrid, cell / kGrid) + float2(Random(), Random())) / float(kGrid) * float2(extent);
+		const int2 origin = clamp(int2(center) - int2(patch / 2u), int2(0), int2(extent - patch));
+		return uint4(uint2(origin), patch);
+	}
+
+	// The projection that maps a crop of the view to the whole image, with splats keeping their pixel size
+	inline static Transform CropProjection(const Transform& projection, const uint2 extent, const uint4 crop) {
+		const float2 scale  = float2(extent) / float2(crop.z, crop.w);
+		const float2 offset = (float2(extent) - 2.f * float2(crop.x, crop.y) - float2(crop.z, crop.w)) / float2(crop.z, crop.w);
+		Transform t = projection;
+		for (uint32_t c = 0; c < 4; c++) {
+			t.transform[c][0] = scale.x * t.transform[c][0] + offset.x * t.transform[c][3];
+			t.transform[c][1] = scale.y * t.transform[c][1] + offset.y * t.transform[c][3];
+		}
+		return t;
+	}
+
+	// Attributes the summed loss of a step's samples to their views and to the cells their crops overlap
+	inline void Update(const std::span<const Sample> samples, const float loss) {
+		uint64_t pixels = 0;
+		for (const Sample& s : samples) pixels += uint64_t(s.crop.z) * s.crop.w;
+		if (pixels == 0 || !std::isfinite(loss)) return;
+		const float pixelLoss = loss / pixels;
+
+		auto blend = [&](float& l) { l = l < 0 ? pixelLoss : decay * l + (1 - decay) * pixelLoss; };
+		for (const Sample& s : samples) {
+			if (s.imageIndex >= viewLosses.size()) continue;
+			blend(viewLosses[s.imageIndex]);
+			const uint2 cellMin = uint2(s.crop.x, s.crop.y) * kGrid / s.extent;
+			const uint2 cellMax = (uint2(s.crop.x, s.crop.y) + uint2(s.crop.z, s.crop.w) - 1u) * kGrid / s.extent;
+			for (uint32_t y = cellMin.y; y <= cellMax.y; y++)
+				for (uint32_t x = cellMin.x; x <= cellMax.x; x++)
+					blend(cellLosses[(size_t(s.imageIndex) * kGrid + y) * kGrid + x]);
+		}
+	}
+
+	inline void DrawGui() {
+		ImGui::Checkbox("Loss-driven sampling", &enabled);
+		if (!enabled) return;
+		ImGui::SliderFloat("Patch scale", &patchScale, 0.05f, 1.f);
+		ImGui::SliderFloat("Uniform weight", &uniformWeight, 0.f, 1.f);
+		ImGui::SliderFloat("Loss decay", &decay, 0.f, 0.99f);
+	}
+};
+
+}
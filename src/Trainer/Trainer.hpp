@@ -0,0 +1,416 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <queue>
+
+#include "Adam/Adam.hpp"
+#include "Densify/DensityControl.hpp"
+#include "PointCloudRenderer/PointCloudRenderer.hpp"
+#include "LossSampler.hpp"
+
+namespace vkgsplat {
+
+using namespace RoseEngine;
+
+// Optimizes a scene's point cloud against its training views with Adam.
+// Shared by the interactive app and the headless trainer.
+struct Trainer {
+	AdamOptimizer adam;
+	bool  fusedAdam = true; // update all attributes in one dispatch, which also clears their gradients
+	bool  sparseAdam = false; // only update the points the backward pass gave gradients. Requires fusedAdam.
+	float vertexStepScale = 1;
+	float colorStepScale  = 1;
+	bool  gradientsCleared = false; // the last fused Adam step cleared the current point cloud's gradients
+	DensityControl densify;
+
+	float resolutionScale = 0.25f;
+	uint32_t batchSize = 1; // views rendered and backpropagated per Adam step
+	LossSampler sampler;    // draws views and patches by loss instead of uniformly
+	float currentLoss = std::numeric_limits<float>::infinity(); // smoothed, negative until the first loss is read back
+	float lastLoss    = std::numeric_limits<float>::infinity();
+
+	// cache initial data so we can quickly restart optimization
+	BufferGradient<3>::Snapshot initialVertices;
+	BufferGradient<4>::Snapshot initialVertexColors;
+	uint32_t initialPointCount = 0;
+
+	// reference images downscaled to resolutionScale, by view. Built on first use, since views may still be loading.
+	std::vector<ImageView> scaledReferences;
+	struct RenderTarget {
+		ImageView image;
+		uint64_t  timelineValue = 0; // signalled when the last work using it completes
+	};
+	std::map<std::pair<uint32_t, uint32_t>, RenderTarget> renderTargets; // by extent
+	size_t maxRenderTargets = 8;
+	ImageView referenceBatch;
+	struct PendingLoss {
+		BufferRange<float> buffer;
+		uint64_t timelineValue;
+		uint32_t viewCount;
+		float    cropScale; // view pixels per rendered pixel, so losses of patches estimate whole views
+		std::vector<LossSampler::Sample> samples;
+	};
+	std::queue<PendingLoss> lossCpuQueue;
+	std::vector<BufferRange<float>> freeLossCpu;
+
+	// context of the last step. Lagged readbacks are on its timeline.
+	const CommandContext* stepContext = nullptr;
+
+	// sparse updates: the point cloud's touched stamps are consistent if the last step was sparse and at touchedStep
+	uint32_t touchedStep = ~0u;
+	uint32_t touchedCountEstimate = 0;
+	std::queue<std::pair<BufferRange<uint32_t>, uint64_t>> touchedCountQueue;
+	std::vector<BufferRange<uint32_t>> freeTouchedCountCpu;
+
+	// Registers the optimizer and densification pipelines. The renderer registers its own.
+	inline void Precompile(ShaderPrecompiler& precompiler) {
+		adam.Precompile(precompiler, { 3, 4 }); // positions, colors
+		densify.Precompile(precompiler);
+	}
+
+	inline void SaveInitialState(CommandContext& context, const PointCloudScene& scene) {
+		initialVertices     = scene.pointCloud.vertices.CreateSnapshot(context);
+		initialVertexColors = scene.pointCloud.vertexColors.CreateSnapshot(context);
+		initialPointCount   = (uint32_t)scene.pointCloud.size();
+		scaledReferences.clear();
+		Reset();
+	}
+
+	inline void RestoreInitialState(CommandContext& context, PointCloudScene& scene) {
+		Reset();
+		if (!scene.pointCloud.vertices) return;
+		// pool slots may hold other chunks than when the state was saved
+		if (scene.streamer) return;
+		if (scene.pointCloud.size() != initialPointCount) {
+			// densification changed the point count
+			scene.pointCloud.vertices     = BufferGradient<3>::Allocate(context, initialPointCount, scene.pointCloud.vertices.format);
+			scene.pointCloud.vertexColors = BufferGradient<4>::Allocate(context, initialPointCount, scene.pointCloud.vertexColors.format);
+		}
+		scene.pointCloud.vertices.Restore(context, initialVertices);
+		scene.pointCloud.vertexColors.Restore(context, initialVertexColors);
+	}
+
+	// Training moves to another context (e.g. an async compute queue) only once the previous one is idle. Consumes
+	// the previous context's readbacks, whose timeline values mean nothing on the new context's timeline.
+	inline void SetStepContext(const CommandContext& context) {
+		if (stepContext == &context) return;
+		if (stepContext) {
+			UpdateLoss(*stepContext);
+			touchedCountQueue = {};
+			densify.pending.reset();
+			densify.retiredPointClouds = {};
+			for (auto& [extent, target] : renderTargets) target.timelineValue = 0;
+		}
+		stepContext = &context;
+	}
+
+	inline void Reset() {
+		adam.reset();
+		densify.Reset();
+		lossCpuQueue = {};
+		touchedStep = ~0u;
+		gradientsCleared = false;
+		sampler.Reset();
+	}
+
+	// Streaming changes which point a pool slot's stamp refers to. Densification allocates a new point cloud,
+	// whose stamps are reinitialized.
+	inline bool UseSparseAdam(const PointCloudScene& scene) const {
+		return sparseAdam && fusedAdam && !scene.streamer;
+	}
+
+	// Makes the backward passes list the points they touch, for a sparse update at the current step
+	inline void BeginTouched(CommandContext& context, PointCloud& pointCloud) {
+		TouchedPoints& touched = pointCloud.touched;
+		const uint32_t vertexCount = (uint32_t)pointCloud.size();
+		if (!touched.stamps || touched.stamps.size() != vertexCount) {
+			const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst;
+			touched.stamps = SharedQueueFamilies::CreateBuffer(context.GetDevice(), vertexCount * sizeof(uint32_t), usage).cast<uint32_t>();
+			touched.list   = SharedQueueFamilies::CreateBuffer(context.GetDevice(), (2 + 2*size_t(vertexCount)) * sizeof(uint32_t), usage).cast<uint32_t>();
+			touchedStep = ~0u;
+		}
+		// after a dense step, every point was last updated in the previous step (stamp t, 0 if none)
+		if (touchedStep != adam.t)
+			context.Fill(touched.stamps, adam.t);
+		context.Fill(touched.list.slice(0, 1), 0u);
+		touched.stamp = adam.t + 1;
+	}
+
+	// Reads back losses of completed steps
+	inline void UpdateLoss(const CommandContext& context) {
+		while (!lossCpuQueue.empty() && ContextTimeline::CurrentValue(context) >= lossCpuQueue.front().timelineValue) {
+			const PendingLoss& pending = lossCpuQueue.front();
+			// NaN if the tiled renderer discarded the step, because its tile keys did not fit
+			if (std::isnan(pending.buffer[0]))
+				adam.discardedSteps++;
+			else if (std::isfinite(pending.buffer[0])) {
+				lastLoss = pending.buffer[0] * pending.cropScale / pending.viewCount;
+				if (sampler.enabled) sampler.Update(pending.samples, pending.buffer[0]);
+				currentLoss = (currentLoss < 0) ? lastLoss : lerp(lastLoss, currentLoss, 0.9f);
+			}
+			freeLossCpu.emplace_back(pending.buffer);
+			lossCpuQueue.pop();
+		}
+	}
+
+	inline uint2 GetScaledExtent(const ImageView& refImg) const {
+		return max(uint2(float2(refImg.Extent())*resolutionScale), uint2(1));
+	}
+
+	// Returns the reference image of a view, downscaled to resolutionScale. The downscaled image is cached,
+	// so each view is only resampled once per resolution scale.
+	inline const ImageView& GetReferenceImage(CommandContext& context, const PointCloudScene& scene, const uint32_t imageIndex) {
+		const ImageView& refImg = scene.images[imageIndex];
+		const uint2 scaledExtent = GetScaledExtent(refImg);
+		if (scaledExtent.x == refImg.Extent().x && scaledExtent.y == refImg.Extent().y)
+			return refImg;
+
+		if (scaledReferences.size() != scene.images.size())
+			scaledReferences.resize(scene.images.size());
+		ImageView& scaledRefImg = scaledReferences[imageIndex];
+		if (!scaledRefImg || scaledRefImg.Extent().x != scaledExtent.x || scaledRefImg.Extent().y != scaledExtent.y) {
+			scaledRefImg = ImageView::Create(
+				Image::Create(context.GetDevice(), ImageInfo{
+					.format = refImg.GetImage()->Info().format,
+					.extent = uint3(scaledExtent, 1u),
+					.usage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+					.queueFamilies = SharedQueueFamilies::Get(context) }));
+			context.Blit(refImg, scaledRefImg);
+		}
+		return scaledRefImg;
+	}
+
+	// Bytes held by the downscaled reference cache
+	inline size_t ScaledReferenceBytes() const {
+		size_t bytes = 0;
+		for (const ImageView& img : scaledReferences)
+			if (img) bytes += size_t(img.Extent().x) * img.Extent().y * 4;
+		return bytes;
+	}
+
+	// Copies the downscaled reference images of a batch, or crops (x, y, width, height) of them, into their slots
+	// of one image, stacked vertically
+	inline const ImageView& GetReferenceBatch(CommandContext& context, const PointCloudScene& scene, const std::span<const uint32_t> imageIndices, const uint32_t slotHeight, const uint2 extent, const std::span<const uint4> crops = {}) {
+		std::vector<ImageView> refImgs;
+		refImgs.reserve(imageIndices.size());
+		for (const uint32_t imageIndex : imageIndices)
+			refImgs.emplace_back(GetReferenceImage(context, scene, imageIndex));
+
+		if (!referenceBatch || referenceBatch.Extent().x != extent.x || referenceBatch.Extent().y != extent.y) {
+			referenceBatch = ImageView::Create(
+				Image::Create(context.GetDevice(), ImageInfo{
+					.format = refImgs[0].GetImage()->Info().format,
+					.extent = uint3(extent, 1u),
+					.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+					.queueFamilies = SharedQueueFamilies::Get(context) }));
+		}
+
+		context.AddBarrier(referenceBatch, Image::ResourceState{
+			.layout = vk::ImageLayout::eTransferDstOptimal,
+			.stage  = vk::PipelineStageFlagBits2::eCopy,
+			.access = vk::AccessFlagBits2::eTransferWrite,
+			.queueFamily = context.QueueFamily() });
+		for (const ImageView& refImg : refImgs)
+			context.AddBarrier(refImg, Image::ResourceState{
+				.layout = vk::ImageLayout::eTransferSrcOptimal,
+				.stage  = vk::PipelineStageFlagBits2::eCopy,
+				.access = vk::AccessFlagBits2::eTransferRead,
+				.queueFamily = context.QueueFamily() });
+		context.ExecuteBarriers();
+
+		for (size_t i = 0; i < refImgs.size(); i++) {
+			const uint4 crop = i < crops.size() ? crops[i] : uint4(0, 0, uint2(refImgs[i].Extent()));
+			const vk::ImageCopy region = {
+				.srcSubresource = vk::ImageSubresourceLayers{ .aspectMask = vk::ImageAspectFlagBits::eColor, .layerCount = 1 },
+				.srcOffset      = vk::Offset3D{ int32_t(crop.x), int32_t(crop.y), 0 },
+				.dstSubresource = vk::ImageSubresourceLayers{ .aspectMask = vk::ImageAspectFlagBits::eColor, .layerCount = 1 },
+				.dstOffset      = vk::Offset3D{ 0, int32_t(i * slotHeight), 0 },
+				.extent         = vk::Extent3D{ crop.z, crop.w, 1 } };
+			context->copyImage(**refImgs[i].GetImage(), vk::ImageLayout::eTransferSrcOptimal, **referenceBatch.GetImage(), vk::ImageLayout::eTransferDstOptimal, region);
+		}
+		return referenceBatch;
+	}
+
+	// Render targets are kept by extent, since views of a scene can differ in size. Beyond maxRenderTargets,
+	// the least recently used targets are freed once the GPU is done with them.
+	inline const ImageView& GetRenderTarget(CommandContext& context, const uint2 extent) {
+		const std::pair<uint32_t, uint32_t> key = { extent.x, extent.y };
+		if (!renderTargets.contains(key)) {
+			while (renderTargets.size() >= maxRenderTargets) {
+				const auto oldest = std::ranges::min_element(renderTargets, {}, [](const auto& t) { return t.second.timelineValue; });
+				if (oldest->second.timelineValue > ContextTimeline::CurrentValue(context)) break;
+				renderTargets.erase(oldest);
+			}
+		}
+		RenderTarget& target = renderTargets[key];
+		target.timelineValue = ContextTimeline::NextSignal(context);
+		ImageView& renderTarget = target.image;
+		if (!renderTarget) {
+			renderTarget = ImageView::Create(
+				Image::Create(context.GetDevice(), ImageInfo{
+					.format = vk::Format::eR16G16B16A16Sfloat,
+					.extent = uint3(extent, 1u),
+					.usage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eStorage,
+					.queueFamilies = SharedQueueFamilies::Get(context) }));
+		}
+		return renderTarget;
+	}
+
+	inline void StepAdam(CommandContext& context, PointCloudScene& scene) {
+		SetStepContext(context);
+		TouchedPoints& touched = scene.pointCloud.touched;
+		if (fusedAdam && touched) {
+			while (!touchedCountQueue.empty() && ContextTimeline::CurrentValue(context) >= touchedCountQueue.front().second) {
+				const uint32_t count = touchedCountQueue.front().first[0];
+				// grow immediately, shrink slowly since different views touch different points
+				touchedCountEstimate = std::max(count, touchedCountEstimate - (touchedCountEstimate - std::min(count, touchedCountEstimate))/8);
+				freeTouchedCountCpu.emplace_back(touchedCountQueue.front().first);
+				touchedCountQueue.pop();
+			}
+
+			const AdamTensor tensors[] = {
+				AdamTensor::Create(scene.pointCloud.vertices,     vertexStepScale),
+				AdamTensor::Create(scene.pointCloud.vertexColors, colorStepScale) };
+			const uint32_t threadCount = std::min<uint32_t>((uint32_t)scene.pointCloud.size(), std::max(touchedCountEstimate + touchedCountEstimate/4, 1u << 16));
+			adam(context, tensors, touched.list, touched.stamp, threadCount);
+
+			BufferRange<uint32_t> countCpu = GetReadbackBuffer(freeTouchedCountCpu, context.GetDevice());
+			context.Copy(touched.list.slice(0, 1), countCpu);
+			touchedCountQueue.push({ countCpu, ContextTimeline::NextSignal(context) });
+
+			// the next step starts at the stamp of this one
+			touchedStep   = touched.stamp;
+			touched.stamp = 0;
+		} else if (fusedAdam) {
+			const AdamTensor tensors[] = {
+				AdamTensor::Create(scene.pointCloud.vertices,     vertexStepScale),
+				AdamTensor::Create(scene.pointCloud.vertexColors, colorStepScale) };
+			adam(context, tensors);
+		} else {
+			adam(context, scene.pointCloud.vertices,     vertexStepScale);
+			adam(context, scene.pointCloud.vertexColors, colorStepScale);
+		}
+		gradientsCleared = fusedAdam;
+	}
+
+	// Renders batchSize random training views, backpropagates their summed loss and steps Adam once.
+	// With the tiled renderer, the views are binned, sorted and rendered together in shared dispatches.
+	// With the loss sampler, views are drawn by loss and only a patch of each is rendered.
+	// Returns false if a sampled view has not been loaded yet.
+	inline bool Step(CommandContext& context, PointCloudScene& scene, PointCloudRenderer& renderer) {
+		if (scene.numTrainCameras == 0) return false;
+		SetStepContext(context);
+
+		// sample distinct views, unless the batch is larger than the training set
+		std::vector<uint32_t> imageIndices;
+		const uint32_t viewCount = std::max(batchSize, 1u);
+		const bool distinct = viewCount <= scene.numTrainCameras;
+		while (imageIndices.size() < viewCount) {
+			const uint32_t imageIndex = sampler.enabled ?
+				sampler.SampleView(scene.numTrainCameras, distinct ? std::span<const uint32_t>(imageIndices) : std::span<const uint32_t>{}) :
+				rand() % scene.numTrainCameras;
+			if (distinct && std::ranges::find(imageIndices, imageIndex) != imageIndices.end()) continue;
+			if (!scene.images[imageIndex]) return false;
+			imageIndices.emplace_back(imageIndex);
+		}
+
+		// rendered region of each view
+		std::vector<LossSampler::Sample> samples;
+		uint64_t viewPixels = 0, cropPixels = 0;
+		for (const uint32_t imageIndex : imageIndices) {
+			const uint2 scaledExtent = GetScaledExtent(scene.images[imageIndex]);
+			const uint4 crop = sampler.enabled ? sampler.SampleCrop(imageIndex, scaledExtent) : uint4(0, 0, scaledExtent);
+			samples.emplace_back(LossSampler::Sample{ .imageIndex = imageIndex, .extent = scaledExtent, .crop = crop });
+			viewPixels += uint64_t(scaledExtent.x) * scaledExtent.y;
+			cropPixels += uint64_t(crop.z) * crop.w;
+		}
+		auto getProjection = [&](const LossSampler::Sample& s) {
+			const Transform proj = Transform{ scene.projectionTransformsCpu[s.imageIndex] };
+			return (s.crop.z == s.extent.x && s.crop.w == s.extent.y) ? proj : LossSampler::CropProjection(proj, s.extent, s.crop);
+		};
+
+		if (scene.streamer) {
+			std::vector<float4x4> viewProjections;
+			for (const LossSampler::Sample& s : samples)
+				viewProjections.emplace_back(getProjection(s).transform * scene.viewTransformsCpu[s.imageIndex]);
+			scene.streamer->Update(context, viewProjections);
+		}
+
+		if (adam.t == 0)
+			currentLoss = -1;
+
+		UpdateLoss(context);
+
+		BufferRange<float> lossCpu = GetReadbackBuffer(freeLossCpu, context.GetDevice());
+		lossCpuQueue.push({ lossCpu, ContextTimeline::NextSignal(context), viewCount, float(viewPixels) / float(cropPixels), samples });
+		BufferRange<float> lossBuf = context.GetTransientBuffer<float>(1, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
+
+		context.Fill(lossBuf, 0.f);
+		if (!gradientsCleared) {
+			scene.pointCloud.vertices.clearGradients(context);
+			scene.pointCloud.vertexColors.clearGradients(context);
+		}
+		if (UseSparseAdam(scene))
+			BeginTouched(context, scene.pointCloud);
+
+		GpuProfiler::PushRegion(context, "Render gradients");
+		if (renderer.tiledGradients && viewCount > 1) {
+			std::vector<TiledView> views;
+			std::vector<uint4> crops;
+			uint2 extent = uint2(1, 0);
+			for (const LossSampler::Sample& s : samples) {
+				const uint2 cropExtent = uint2(s.crop.z, s.crop.w);
+				views.emplace_back(TiledView::Create(Transform{ scene.viewTransformsCpu[s.imageIndex] }, getProjection(s), cropExtent));
+				crops.emplace_back(s.crop);
+				extent = max(extent, cropExtent);
+			}
+			const uint32_t slotHeight = PointCloudRenderer::GetSlotHeight(extent.y);
+			extent.y = slotHeight * viewCount;
+
+			const ImageView& refBatch = GetReferenceBatch(context, scene, imageIndices, slotHeight, extent, crops);
+			const ImageView& target   = GetRenderTarget(context, extent);
+			renderer.RenderGradientsBatch(context, target, scene.pointCloud, views, slotHeight, refBatch, lossBuf);
+		} else {
+			// gradients of each view accumulate until the Adam step
+			for (const LossSampler::Sample& s : samples) {
+				const Transform view = Transform{ scene.viewTransformsCpu[s.imageIndex] };
+				const Transform proj = getProjection(s);
+
+				// patches are copied out of the reference, since the renderers index it by output pixel
+				const uint2 cropExtent = uint2(s.crop.z, s.crop.w);
+				const bool whole = cropExtent.x == s.extent.x && cropExtent.y == s.extent.y;
+				const ImageView& refImg = whole ?
+					GetReferenceImage(context, scene, s.imageIndex) :
+					GetReferenceBatch(context, scene, std::span(&s.imageIndex, 1), cropExtent.y, cropExtent, std::span(&s.crop, 1));
+				const ImageView& target = GetRenderTarget(context, cropExtent);
+				renderer.RenderGradients(context, target, scene.pointCloud, view, proj, refImg, lossBuf);
+			}
+		}
+		GpuProfiler::PopRegion(context);
+
+		context.Copy(lossBuf, lossCpu);
+
+		// densification would reallocate the streaming pool
+		if ((densify.enabled || densify.pending) && !scene.streamer)
+			densify.AccumulateStatistics(context, scene.pointCloud);
+
+		// a discarded frame has no gradients, so its Adam step leaves the points and moments unchanged
+		GpuProfiler::PushRegion(context, "Adam");
+		adam.stepLoss = lossBuf;
+		StepAdam(context, scene);
+		adam.stepLoss = {};
+		adam.increment();
+		GpuProfiler::PopRegion(context);
+
+		if (scene.streamer)
+			scene.streamer->MarkResidentDirty();
+		else
+			densify.Update(context, scene.pointCloud, adam.t, renderer.pointSize);
+
+		return true;
+	}
+};
+
+}